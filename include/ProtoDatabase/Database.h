@@ -1,21 +1,130 @@
 #pragma once
 
+#include <ProtoDatabase/DatabaseOptions.h>
+#include <ProtoDatabase/DatabaseStats.h>
+#include <ProtoDatabase/MessageCache.h>
+#include <ProtoDatabase/StatementCache.h>
+#include <ProtoDatabase/TablePlan.h>
+
 #include <SQLiteCpp/Database.h>
 
+#include <google/protobuf/arena.h>
+#include <google/protobuf/field_mask.pb.h>
 #include <google/protobuf/message.h>
 
+#include <array>
+#include <functional>
+#include <initializer_list>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <span>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 
 namespace ProtoDatabase
 {
 
+template<typename Message>
+class MessageCursor;
+
+template<typename Message>
+class Query;
+
+struct QueryFilter;
+struct QueryAggregate;
+
+/**
+ * @brief FieldPath
+ *
+ * Field of the message or field of nested messages reached through the chain of singular message fields
+ */
+using FieldPath = std::vector<const google::protobuf::FieldDescriptor*>;
+
+/**
+ * @brief The ReadMode enum
+ *
+ * Lazy reads fill only fields stored in the row of the message itself. Nested messages, repeated and map fields
+ * stay empty until they are loaded by Database::loadField()
+ */
+enum class ReadMode
+{
+    Eager,
+    Lazy
+};
+
+/**
+ * @brief The ScanOrder enum
+ */
+enum class ScanOrder
+{
+    Ascending,
+    Descending
+};
+
+/**
+ * @brief The ScanOptions struct
+ *
+ * Page of a scan: messages are ordered by the scanned field (and by insertion for equal values),
+ * the page continues the scan stopped with the resume token
+ */
+struct ScanOptions
+{
+    ScanOrder order = ScanOrder::Ascending;
+    // max number of messages in the page, 0 means no limit
+    size_t limit = 100;
+    std::string resumeToken;
+};
+
+/**
+ * @brief The ScanPage struct
+ *
+ * Messages of one page of a scan and the token to request the next page, the token is empty after the last page
+ */
+template<typename Message>
+struct ScanPage
+{
+    std::vector<Message> messages;
+    std::string resumeToken;
+};
+
 class EXPORT_ProtoDatabase Database
 {
 public:
+    /**
+     * @brief The Transaction class
+     *
+     * Scope in which all operations of the database join one transaction. The outermost scope commits the changes,
+     * nested scopes are savepoints. Changes are rolled back if the scope is left without commit
+     */
+    class EXPORT_ProtoDatabase Transaction
+    {
+    public:
+        explicit Transaction(Database& database);
+        Transaction(const Transaction&) = delete;
+        Transaction& operator=(const Transaction&) = delete;
+        ~Transaction();
+
+        void commit();
+        void rollback();
+
+    private:
+        void finish(const std::string& command);
+
+    private:
+        Database& database;
+        std::string name;
+        bool finished = false;
+    };
+
     Database();
-    Database(const std::string& path);
+    explicit Database(const DatabaseOptions& options);
+    Database(const std::string& path, const DatabaseOptions& options = DatabaseOptions{});
 
     /**
      * @brief getTableCount
@@ -60,64 +169,485 @@ public:
     /**
      * @brief writeMessage
      *
-     * Creates a new row with data from the message or update an old row if there will be conflicts with unique keys
+     * Creates a new row with data from the message or update an old row if there will be conflicts with unique keys.
+     * Stored elements of repeated and map fields of the updated row are kept if they aren't changed
      *
      * @param message - object to write into the database
      * @return ID of inserted row
      */
     int64_t writeMessage(const google::protobuf::Message& message);
 
+    /**
+     * @brief insertMessages
+     *
+     * Creates rows for all messages in one transaction. Messages of the same type going in a row are written
+     * by multi-row statements, so the call throws an exception and writes nothing if any of them conflicts with unique keys
+     *
+     * @param messages - objects to write into the database
+     * @return IDs of inserted rows in order of messages
+     */
+    std::vector<int64_t> insertMessages(std::span<const google::protobuf::Message* const> messages);
+
+    /**
+     * @brief insertMessages
+     * @param messages - range of messages or pointers to messages
+     * @return IDs of inserted rows in order of messages
+     */
+    template<typename Range>
+    std::vector<int64_t> insertMessages(const Range& messages)
+    {
+        auto pointers = getMessagePointers(messages);
+        return insertMessages(std::span<const google::protobuf::Message* const>{ pointers });
+    }
+
+    /**
+     * @brief writeMessages
+     *
+     * Creates or updates rows for all messages in one transaction reusing one compiled statement per table
+     *
+     * @param messages - objects to write into the database
+     * @return IDs of written rows in order of messages
+     */
+    std::vector<int64_t> writeMessages(std::span<const google::protobuf::Message* const> messages);
+
+    /**
+     * @brief writeMessages
+     * @param messages - range of messages or pointers to messages
+     * @return IDs of written rows in order of messages
+     */
+    template<typename Range>
+    std::vector<int64_t> writeMessages(const Range& messages)
+    {
+        auto pointers = getMessagePointers(messages);
+        return writeMessages(std::span<const google::protobuf::Message* const>{ pointers });
+    }
+
     /**
      * @brief findMessage
      * @param field - key field
      * @param key - value for search
+     * @param mode - lazy mode leaves nested messages, repeated and map fields to loadField()
      * @return found message or empty optional
      */
     template<typename Message, typename Key>
-    std::optional<Message> findMessage(const google::protobuf::FieldDescriptor* field, const Key& key)
+    std::optional<Message> findMessage(const google::protobuf::FieldDescriptor* field, const Key& key, ReadMode mode = ReadMode::Eager)
     {
-        if (!isKey(field))
-            throw std::logic_error("field is not a key for " + Message::GetDescriptor()->name());
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::FindMessage));
+
+        if (auto cached = findCachedMessage<Message>(field, key))
+            return *cached;
+
+        auto query = findRow<Message>(field, key);
+        if (!query)
+            return std::optional<Message>{};
 
-        SQLite::Statement query{ database, "SELECT * FROM " + Message::GetDescriptor()->name() + " WHERE " + getColumnName(field->name()) + "=?;" };
+        Message message;
+        readFields(**query, &message, 0, mode);
+        if (mode == ReadMode::Eager)
+            messageCache.insert(field, key, message);
+        return message;
+    }
+
+    /**
+     * @brief findMessage
+     *
+     * Reads only requested fields, other columns and tables of repeated and map fields aren't queried
+     *
+     * @param field - key field
+     * @param key - value for search
+     * @param fields - top-level fields of the message to be read
+     * @return found message or empty optional
+     */
+    template<typename Message, typename Key>
+    std::optional<Message> findMessage(const google::protobuf::FieldDescriptor* field, const Key& key, std::span<const google::protobuf::FieldDescriptor* const> fields)
+    {
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::FindMessage));
+
+        const auto& projection = getProjection(Message::GetDescriptor(), fields);
+        auto query = selectByField<Message>(field, key, &projection);
+        if (!query || !(*query)->executeStep())
+            return std::optional<Message>{};
+
+        Message message;
+        readProjection(**query, &message, projection);
+        return message;
+    }
+
+    /**
+     * @brief findMessage
+     * @param field - key field
+     * @param key - value for search
+     * @param mask - paths of fields to be read, nested paths select whole top-level fields
+     * @return found message or empty optional
+     */
+    template<typename Message, typename Key>
+    std::optional<Message> findMessage(const google::protobuf::FieldDescriptor* field, const Key& key, const google::protobuf::FieldMask& mask)
+    {
+        return findMessage<Message>(field, key, getMaskFields(Message::GetDescriptor(), mask));
+    }
+
+    /**
+     * @brief findMessages
+     *
+     * Finds messages for a batch of keys by one query and reads repeated and map fields of all found messages
+     * by one query per field instead of a query per key
+     *
+     * @param field - key field
+     * @param keys - values for search
+     * @return found messages in order of keys, empty optional for keys without messages
+     */
+    template<typename Message, typename Key>
+    std::vector<std::optional<Message>> findMessages(const google::protobuf::FieldDescriptor* field, std::span<const Key> keys)
+    {
+        checkLookupField(Message::GetDescriptor(), field);
+
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::FindMessages));
+
+        std::vector<std::optional<Message>> res(keys.size());
+
+        std::vector<size_t> positions;
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            if (auto cached = findCachedMessage<Message>(field, keys[i]))
+                res[i] = *cached;
+            else
+                positions.emplace_back(i);
+        }
+        if (positions.empty())
+            return res;
+
+        std::vector<std::optional<int64_t>> keyIds;
         if constexpr(std::is_base_of<google::protobuf::Message, Key>::value)
         {
-            auto keyId = findMessage(key);
-            if (!keyId)
-                return std::optional<Message>{};
-            query.bind(1, keyId.value());
+            std::vector<const google::protobuf::Message*> keyMessages;
+            for (size_t position : positions)
+                keyMessages.emplace_back(&keys[position]);
+            keyIds.resize(keys.size());
+            auto ids = findMessages(keyMessages);
+            for (size_t i = 0; i < positions.size(); ++i)
+                keyIds[positions[i]] = ids[i];
+
+            std::erase_if(positions, [&keyIds](size_t position) { return !keyIds[position]; });
+        }
+
+        auto bindKey = [&keys, &keyIds](SQLite::Statement& query, int index, size_t position) {
+            if constexpr(std::is_base_of<google::protobuf::Message, Key>::value)
+                query.bind(index, keyIds[position].value());
+            else
+                bindValue(query, index, keys[position]);
+        };
+        auto createMessage = [&res](size_t position) -> google::protobuf::Message* {
+            return &res[position].emplace();
+        };
+        findRows(getPlan(Message::GetDescriptor()), field, positions, bindKey, createMessage);
+
+        for (size_t position : positions)
+        {
+            if (res[position])
+                messageCache.insert(field, keys[position], *res[position]);
         }
+        return res;
+    }
+
+    /**
+     * @brief findMessages
+     * @param field - key field
+     * @param keys - values for search
+     * @return found messages in order of keys, empty optional for keys without messages
+     */
+    template<typename Message, typename Key>
+    std::vector<std::optional<Message>> findMessages(const google::protobuf::FieldDescriptor* field, const std::vector<Key>& keys)
+    {
+        return findMessages<Message>(field, std::span<const Key>(keys));
+    }
+
+    /**
+     * @brief scanRange
+     *
+     * Reads a page of messages with values of the field in the range. The scan goes through the index of the field
+     * and continues after the last row of the previous page, so every page costs its size regardless of the offset
+     *
+     * @param field - key or indexed field
+     * @param from - lower bound of values (included), empty optional means no bound
+     * @param to - upper bound of values (excluded), empty optional means no bound
+     * @param options - order, size of the page and resume token of the previous page
+     * @return page of messages
+     */
+    template<typename Message, typename Key>
+    ScanPage<Message> scanRange(const google::protobuf::FieldDescriptor* field, const std::optional<Key>& from, const std::optional<Key>& to, const ScanOptions& options = {}) const
+    {
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::ScanRange));
+
+        std::function<void(SQLite::Statement&, int)> bindFrom;
+        if (from)
+            bindFrom = [&from](SQLite::Statement& query, int index) { bindValue(query, index, from.value()); };
+
+        std::function<void(SQLite::Statement&, int)> bindTo;
+        if (to)
+            bindTo = [&to](SQLite::Statement& query, int index) { bindValue(query, index, to.value()); };
+
+        ScanPage<Message> page;
+        auto ids = scanRows(Message::GetDescriptor(), field, bindFrom, bindTo, options, page.resumeToken, [&page]() -> google::protobuf::Message* {
+            return &page.messages.emplace_back();
+        });
+
+        std::vector<std::pair<int64_t, google::protobuf::Message*>> rows;
+        rows.reserve(ids.size());
+        for (size_t i = 0; i < ids.size(); ++i)
+            rows.emplace_back(ids[i], &page.messages[i]);
+        readChildren(getPlan(Message::GetDescriptor()), rows);
+
+        return page;
+    }
+
+    /**
+     * @brief scanPrefix
+     * @param field - string key or indexed field
+     * @param prefix - beginning of values of the field
+     * @param options - order, size of the page and resume token of the previous page
+     * @return page of messages with values of the field starting with the prefix
+     */
+    template<typename Message>
+    ScanPage<Message> scanPrefix(const google::protobuf::FieldDescriptor* field, const std::string& prefix, const ScanOptions& options = {}) const
+    {
+        if (field->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_STRING)
+            throw std::logic_error("prefix scan of not string field " + field->name());
+
+        // range of values with the prefix ends before the prefix with the last byte incremented
+        std::optional<std::string> to = prefix;
+        while (!to->empty() && static_cast<unsigned char>(to->back()) == 0xFF)
+            to->pop_back();
+        if (to->empty())
+            to.reset();
         else
+            to->back() = static_cast<char>(static_cast<unsigned char>(to->back()) + 1);
+
+        return scanRange<Message, std::string>(field, prefix, to, options);
+    }
+
+    /**
+     * @brief query
+     *
+     * Starts a request filtering messages by conditions on their columns, see Query
+     *
+     * @return empty query selecting all messages of the type
+     */
+    template<typename Message>
+    Query<Message> query() const
+    {
+        return Query<Message>{ *this };
+    }
+
+    /**
+     * @brief findAllMessages
+     * @param field - key or indexed field
+     * @param key - value for search
+     * @return all messages with the value of the field in order of insertion
+     */
+    template<typename Message, typename Key>
+    std::vector<Message> findAllMessages(const google::protobuf::FieldDescriptor* field, const Key& key)
+    {
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::FindAllMessages));
+
+        std::vector<Message> res;
+        auto query = selectByField<Message>(field, key);
+        if (!query)
+            return res;
+
+        while ((*query)->executeStep())
         {
-            query.bind(1, key);
+            Message message;
+            readFields(**query, &message);
+            res.emplace_back(std::move(message));
         }
+        return res;
+    }
 
-        if (!query.executeStep())
-            return std::optional<Message>{};
+    /**
+     * @brief findMessage
+     *
+     * Reads the message into the arena, so nested messages, repeated fields and strings are allocated on the arena too
+     *
+     * @param field - key field
+     * @param key - value for search
+     * @param arena - arena owning the result
+     * @return found message or nullptr
+     */
+    template<typename Message, typename Key>
+    Message* findMessage(const google::protobuf::FieldDescriptor* field, const Key& key, google::protobuf::Arena* arena)
+    {
+        if (!arena)
+            throw std::logic_error("no arena to allocate " + Message::GetDescriptor()->name());
 
-        Message message;
-        readFields(query, &message);
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::FindMessage));
+
+        if (auto cached = findCachedMessage<Message>(field, key))
+        {
+            auto message = google::protobuf::Arena::CreateMessage<Message>(arena);
+            message->CopyFrom(*cached);
+            return message;
+        }
+
+        auto query = findRow<Message>(field, key);
+        if (!query)
+            return nullptr;
+
+        auto message = google::protobuf::Arena::CreateMessage<Message>(arena);
+        readFields(**query, message);
+        messageCache.insert(field, key, *message);
         return message;
     }
 
     /**
      * @brief getAllMessages
+     * @param mode - lazy mode leaves nested messages, repeated and map fields to loadField()
      * @return all messages of selected type
      */
     template<typename Message>
-    std::vector<Message> getAllMessages() const
+    std::vector<Message> getAllMessages(ReadMode mode = ReadMode::Eager) const
     {
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::GetAllMessages));
+
         std::vector<Message> res;
-        auto query = getAllObjects(Message::GetDescriptor()->name());
-        while(query.executeStep())
+        auto query = getAllObjects(Message::GetDescriptor());
+        while(query->executeStep())
         {
             Message message;
-            readFields(query, &message);
+            readFields(*query, &message, 0, mode);
             res.emplace_back(std::move(message));
         }
         return res;
     }
 
+    /**
+     * @brief getAllMessages
+     * @param arena - arena owning the result, all nested objects of messages are allocated on it too
+     * @return all messages of selected type
+     */
+    template<typename Message>
+    std::vector<Message*> getAllMessages(google::protobuf::Arena* arena) const
+    {
+        if (!arena)
+            throw std::logic_error("no arena to allocate " + Message::GetDescriptor()->name());
+
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::GetAllMessages));
+
+        std::vector<Message*> res;
+        auto query = getAllObjects(Message::GetDescriptor());
+        while(query->executeStep())
+        {
+            auto message = google::protobuf::Arena::CreateMessage<Message>(arena);
+            readFields(*query, message);
+            res.emplace_back(message);
+        }
+        return res;
+    }
+
+    /**
+     * @brief getAllMessages
+     *
+     * Reads only requested fields, other columns and tables of repeated and map fields aren't queried
+     *
+     * @param fields - top-level fields of the message to be read
+     * @return all messages of selected type
+     */
+    template<typename Message>
+    std::vector<Message> getAllMessages(std::span<const google::protobuf::FieldDescriptor* const> fields) const
+    {
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::GetAllMessages));
+
+        const auto& projection = getProjection(Message::GetDescriptor(), fields);
+        auto query = statements.acquire({ &projection, StatementCache::Operation::SelectAll }, [&projection]() {
+            return projection.selectAllSql;
+        });
+
+        std::vector<Message> res;
+        while(query->executeStep())
+        {
+            Message message;
+            readProjection(*query, &message, projection);
+            res.emplace_back(std::move(message));
+        }
+        return res;
+    }
+
+    /**
+     * @brief getAllMessages
+     * @param mask - paths of fields to be read, nested paths select whole top-level fields
+     * @return all messages of selected type
+     */
+    template<typename Message>
+    std::vector<Message> getAllMessages(const google::protobuf::FieldMask& mask) const
+    {
+        return getAllMessages<Message>(getMaskFields(Message::GetDescriptor(), mask));
+    }
+
+    /**
+     * @brief getMessageCursor
+     *
+     * Opens lazy sequence of all messages of selected type, rows are read and decoded while the cursor is iterated
+     *
+     * @param reuse - message refilled for every row instead of the message owned by the cursor, it may be nullptr
+     * @param mode - lazy mode leaves nested messages, repeated and map fields to loadField()
+     * @return cursor usable in range-based for
+     */
+    template<typename Message>
+    MessageCursor<Message> getMessageCursor(Message* reuse = nullptr, ReadMode mode = ReadMode::Eager) const
+    {
+        return MessageCursor<Message>{ *this, getAllObjects(Message::GetDescriptor()), reuse, mode };
+    }
+
+    /**
+     * @brief forEachMessage
+     *
+     * Scans all messages of selected type decoding every row into the same message object, so the scan doesn't
+     * allocate memory for fields which were already allocated by previous rows
+     *
+     * @param callback - called for every message, the scan stops if it returns false
+     * @param reuse - caller's message (it may be allocated on an arena) refilled for every row, it may be nullptr
+     * @param mode - lazy mode leaves nested messages, repeated and map fields to loadField()
+     */
+    template<typename Message, typename Callback>
+    void forEachMessage(Callback&& callback, Message* reuse = nullptr, ReadMode mode = ReadMode::Eager) const
+    {
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::ScanMessages));
+
+        auto cursor = getMessageCursor<Message>(reuse, mode);
+        while (cursor.next())
+        {
+            if constexpr(std::is_convertible_v<std::invoke_result_t<Callback&, const Message&>, bool>)
+            {
+                if (!callback(cursor.current()))
+                    break;
+            }
+            else
+            {
+                callback(cursor.current());
+            }
+        }
+    }
+
+    /**
+     * @brief loadField
+     *
+     * Reads a field left empty by lazy read. The row of the message is found by its keys
+     *
+     * @param message - message read in lazy mode
+     * @param field - nested message, repeated or map field of the message
+     */
+    void loadField(google::protobuf::Message* message, const google::protobuf::FieldDescriptor* field) const;
+
+    /**
+     * @brief loadField
+     *
+     * Reads a field left empty by lazy read
+     *
+     * @param message - message read in lazy mode
+     * @param field - nested message, repeated or map field of the message
+     * @param id - ID of the row of the message, see MessageCursor::getId()
+     */
+    void loadField(google::protobuf::Message* message, const google::protobuf::FieldDescriptor* field, int64_t id) const;
+
     /**
      * @brief getValue
      * @param field - selected data
@@ -126,40 +656,86 @@ public:
     template<typename Value, typename Message>
     std::vector<Value> getValue(const google::protobuf::FieldDescriptor* field)
     {
-        SQLite::Statement query{ database, "SELECT " + getColumnName(field->name()) + " FROM " + Message::GetDescriptor()->name() + " ORDER BY id;" };
+        if (!getPlan(Message::GetDescriptor()).findColumn(field))
+            throw std::logic_error("field " + field->name() + " isn't stored in a column of " + Message::GetDescriptor()->name());
+
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::GetValue));
+
+        auto query = statements.acquire({ field, StatementCache::Operation::SelectColumn }, [field]() {
+            return "SELECT " + getColumnName(field->name()) + " FROM " + Message::GetDescriptor()->name() + " ORDER BY id;";
+        });
 
         std::vector<Value> res;
-        while(query.executeStep())
+        while(query->executeStep())
         {
             Value val;
             if constexpr(std::is_base_of_v<google::protobuf::FieldDescriptor, Value>)
             {
-                findMessage(field->message_type()->name(), query.getColumn(0), &val);
-            }
-            else if constexpr(std::is_same_v<Value, uint64_t>)
-            {
-                val = static_cast<uint64_t>(query.getColumn(0).getInt64());
-            }
-            else if constexpr(std::is_same_v<Value, float>)
-            {
-                val = static_cast<float>(query.getColumn(0).getDouble());
-            }
-            else if constexpr(std::is_same_v<Value, std::string>)
-            {
-                val = query.getColumn(0).getString();
+                findMessage(field->message_type()->name(), query->getColumn(0), &val);
             }
             else
             {
-                val = query.getColumn(0);
+                val = getColumnValue<Value>(query->getColumn(0));
             }
             res.emplace_back(std::move(val));
         }
         return res;
     }
 
+    /**
+     * @brief getColumns
+     *
+     * Reads values of several fields of all messages into separate contiguous arrays (structure of arrays)
+     * by one statement. Arrays are sized once by the number of rows, numeric values are taken by the storage
+     * class of the cell without conversion through text. std::vector<bool> isn't contiguous,
+     * so values of bool fields are read into std::vector<uint8_t>
+     *
+     * @param fields - scalar fields stored in columns, one per array
+     * @param columns - arrays filled with values in order of insertion of messages
+     * @return number of read messages
+     */
+    template<typename Message, typename... Values>
+    size_t getColumns(const std::array<const google::protobuf::FieldDescriptor*, sizeof...(Values)>& fields, std::vector<Values>&... columns) const
+    {
+        static_assert(!(std::is_same_v<Values, bool> || ...), "std::vector<bool> has no contiguous storage, read bool fields into std::vector<uint8_t>");
+        checkColumnTypes<Values...>(fields);
+
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::GetColumns));
+
+        const size_t count = static_cast<size_t>(countRows(Message::GetDescriptor()));
+        (columns.resize(count), ...);
+
+        int64_t lastId = std::numeric_limits<int64_t>::min();
+        const size_t rows = readColumnValues(Message::GetDescriptor(), fields, lastId, count, columns.data()...);
+        (columns.resize(rows), ...);
+        return rows;
+    }
+
+    /**
+     * @brief getColumns
+     *
+     * Reads the next chunk of values of several fields into caller's buffers, so tables larger than the buffers
+     * are read chunk by chunk. Every chunk continues after the last ID of the previous one
+     *
+     * @param fields - scalar fields stored in columns, one per buffer
+     * @param lastId - ID of the last read message, std::numeric_limits<int64_t>::min() to start from the beginning
+     * @param capacity - number of values every buffer can take
+     * @param columns - buffers filled with values in order of insertion of messages
+     * @return number of read messages, 0 after the last chunk
+     */
+    template<typename Message, typename... Values>
+    size_t getColumns(const std::array<const google::protobuf::FieldDescriptor*, sizeof...(Values)>& fields, int64_t& lastId, size_t capacity, Values*... columns) const
+    {
+        checkColumnTypes<Values...>(fields);
+
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::GetColumns));
+
+        return readColumnValues(Message::GetDescriptor(), fields, lastId, capacity, columns...);
+    }
+
     /**
      * @brief deleteMessage
-     * @param field - key field
+     * @param field - key or indexed field
      * @param key - value for search
      *
      * Removes objects found by specified key
@@ -167,23 +743,98 @@ public:
     template<typename Message, typename Key>
     void deleteMessage(const google::protobuf::FieldDescriptor* field, const Key& key)
     {
-        if (!isKey(field))
-            throw std::logic_error("field is not a key for " + Message::GetDescriptor()->name());
+        checkLookupField(Message::GetDescriptor(), field);
+
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::DeleteMessage));
+        messageCache.invalidate(Message::GetDescriptor());
 
-        SQLite::Statement query{ database, "DELETE FROM " + Message::GetDescriptor()->name() + " WHERE " + getColumnName(field->name()) + "=?;" };
+        std::optional<int64_t> keyId;
         if constexpr(std::is_base_of<google::protobuf::Message, Key>::value)
         {
-            auto keyId = findMessage(key);
+            keyId = findMessage(key);
             if (!keyId)
                 return;
-            query.bind(1, keyId.value());
         }
+
+        auto query = statements.acquire({ field, StatementCache::Operation::DeleteByKey }, [field]() {
+            return "DELETE FROM " + Message::GetDescriptor()->name() + " WHERE " + getColumnName(field->name()) + "=?;";
+        });
+        if constexpr(std::is_base_of<google::protobuf::Message, Key>::value)
+            query->bind(1, keyId.value());
         else
+            query->bind(1, key);
+
+        query->exec();
+    }
+
+    /**
+     * @brief appendRepeated
+     *
+     * Adds elements to the end of a repeated field of stored objects without reading and rewriting present elements
+     *
+     * @param keyField - key or indexed field
+     * @param key - value for search
+     * @param field - repeated field of scalar values
+     * @param values - elements to be added
+     * @return number of updated objects
+     */
+    template<typename Message, typename Key, typename Value>
+    size_t appendRepeated(const google::protobuf::FieldDescriptor* keyField, const Key& key, const google::protobuf::FieldDescriptor* field, std::span<const Value> values)
+    {
+        checkLookupField(Message::GetDescriptor(), keyField);
+        const auto& table = getChildTable(Message::GetDescriptor(), field);
+        if (!isCompatible<Value>(field))
+            throw std::logic_error("type of values doesn't match field " + field->name() + " of " + Message::GetDescriptor()->name());
+
+        ScopedTimer timer(getHistogram(DatabaseStats::Operation::AppendRepeated));
+        messageCache.invalidate(Message::GetDescriptor());
+        Transaction transaction(*this);
+
+        std::optional<int64_t> keyId;
+        if constexpr(std::is_base_of<google::protobuf::Message, Key>::value)
+        {
+            keyId = findMessage(key);
+            if (!keyId)
+                return 0;
+        }
+
+        std::vector<int64_t> ids;
+        {
+            auto query = statements.acquire({ keyField, StatementCache::Operation::SelectId }, [keyField]() {
+                return "SELECT id FROM " + Message::GetDescriptor()->name() + " WHERE " + getColumnName(keyField->name()) + "=? ORDER BY id;";
+            });
+            if constexpr(std::is_base_of<google::protobuf::Message, Key>::value)
+                query->bind(1, keyId.value());
+            else
+                bindValue(*query, 1, key);
+
+            while (query->executeStep())
+                ids.emplace_back(query->getColumn(0).getInt64());
+        }
+
+        for (int64_t id : ids)
         {
-            query.bind(1, key);
+            appendElements(table, id, values.size(), [&values](SQLite::Statement& query, int index, size_t element) {
+                bindValue(query, index, values[element]);
+            });
         }
 
-        query.exec();
+        transaction.commit();
+        return ids.size();
+    }
+
+    /**
+     * @brief appendRepeated
+     * @param keyField - key or indexed field
+     * @param key - value for search
+     * @param field - repeated field of scalar values
+     * @param values - elements to be added
+     * @return number of updated objects
+     */
+    template<typename Message, typename Key, typename Value>
+    size_t appendRepeated(const google::protobuf::FieldDescriptor* keyField, const Key& key, const google::protobuf::FieldDescriptor* field, std::initializer_list<Value> values)
+    {
+        return appendRepeated<Message>(keyField, key, field, std::span<const Value>(values.begin(), values.size()));
     }
 
     /**
@@ -211,38 +862,311 @@ public:
         clearTable(T::GetDescriptor()->name());
     }
 
+    /**
+     * @brief setStatementCacheCapacity
+     * @param capacity - max number of compiled statements kept by the connection, 0 disables caching
+     */
+    void setStatementCacheCapacity(size_t capacity);
+
+    /**
+     * @brief getStatementCacheStats
+     * @return hit/miss counters of the statement cache
+     */
+    StatementCache::Stats getStatementCacheStats() const;
+
+    /**
+     * @brief beginBatch
+     *
+     * Opens a transaction all following calls join until it's committed or destroyed
+     *
+     * @return scope of the transaction
+     */
+    Transaction beginBatch();
+
+    /**
+     * @brief setMessageCacheCapacity
+     * @param capacity - max number of bytes of messages found by keys and kept in memory, 0 disables the cache
+     */
+    void setMessageCacheCapacity(size_t capacity);
+
+    /**
+     * @brief setStatsEnabled
+     *
+     * Turns collection of metrics on or off, it's off by default. Collected values are kept when it's turned off
+     */
+    void setStatsEnabled(bool enabled);
+
+    /**
+     * @brief getStats
+     * @return snapshot of collected metrics
+     */
+    DatabaseStats getStats() const;
+
+    /**
+     * @brief resetStats
+     *
+     * Drops collected metrics
+     */
+    void resetStats();
+
 private:
+    template<typename Message>
+    friend class MessageCursor;
+    template<typename Message>
+    friend class Query;
+
+    void configure(const DatabaseOptions& options);
+    void invalidateCachedMessages(std::span<const google::protobuf::Message* const> messages);
+
+    LatencyHistogram* getHistogram(DatabaseStats::Operation operation) const
+    {
+        return statsEnabled ? &stats.operations[static_cast<size_t>(operation)] : nullptr;
+    }
+
+    template<typename Message, typename Key>
+    std::shared_ptr<const Message> findCachedMessage(const google::protobuf::FieldDescriptor* field, const Key& key)
+    {
+        // field of another type is rejected by the lookup in the database
+        if (field->containing_type() != Message::GetDescriptor())
+            return nullptr;
+
+        return std::static_pointer_cast<const Message>(messageCache.find(field, key));
+    }
+
+    template<typename Message, typename Key>
+    std::optional<StatementCache::Handle> findRow(const google::protobuf::FieldDescriptor* field, const Key& key)
+    {
+        auto query = selectByField<Message>(field, key);
+        if (!query || !(*query)->executeStep())
+            return std::optional<StatementCache::Handle>{};
+
+        return query;
+    }
+
+    template<typename Message, typename Key>
+    std::optional<StatementCache::Handle> selectByField(const google::protobuf::FieldDescriptor* field, const Key& key, const Projection* projection = nullptr)
+    {
+        checkLookupField(Message::GetDescriptor(), field);
+
+        std::optional<int64_t> keyId;
+        if constexpr(std::is_base_of<google::protobuf::Message, Key>::value)
+        {
+            keyId = findMessage(key);
+            if (!keyId)
+                return std::optional<StatementCache::Handle>{};
+        }
+
+        // projected statements are distinguished by the projection and the number of the key field
+        const StatementCache::Key cacheKey = projection ?
+            StatementCache::Key{ projection, StatementCache::Operation::SelectByKey, field->number() } :
+            StatementCache::Key{ field, StatementCache::Operation::SelectByKey };
+        auto query = statements.acquire(cacheKey, [field, projection]() {
+            const std::string select = projection ? projection->selectSql : "SELECT * FROM " + Message::GetDescriptor()->name();
+            return select + " WHERE " + getColumnName(field->name()) + "=? ORDER BY id;";
+        });
+        if constexpr(std::is_base_of<google::protobuf::Message, Key>::value)
+            query->bind(1, keyId.value());
+        else
+            query->bind(1, key);
+
+        return query;
+    }
+
+    template<typename Value>
+    static bool isCompatible(const google::protobuf::FieldDescriptor* field)
+    {
+        switch (field->cpp_type())
+        {
+        case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
+            return std::is_convertible_v<Value, std::string>;
+        case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE:
+        case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT:
+            return std::is_floating_point_v<Value>;
+        case google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE:
+            return false;
+        default:
+            return std::is_integral_v<Value> || std::is_enum_v<Value>;
+        }
+    }
+
+    template<typename Value>
+    static Value getColumnValue(const SQLite::Column& column)
+    {
+        if constexpr(std::is_same_v<Value, bool>)
+            return column.getInt() != 0;
+        else if constexpr(std::is_enum_v<Value>)
+            return static_cast<Value>(column.getInt());
+        else if constexpr(std::is_same_v<Value, uint64_t>)
+            return static_cast<uint64_t>(column.getInt64());
+        else if constexpr(std::is_same_v<Value, float>)
+            return static_cast<float>(column.getDouble());
+        else if constexpr(std::is_same_v<Value, std::string>)
+            return column.getString();
+        else
+            return column;
+    }
+
+    // numeric cells are read by their storage class, other ones are converted by SQLite
+    template<typename Value>
+    static Value getCellValue(const SQLite::Column& column)
+    {
+        if constexpr(std::is_arithmetic_v<Value>)
+        {
+            const int type = column.getType();
+            if (type == SQLite::INTEGER)
+                return static_cast<Value>(column.getInt64());
+            if (type == SQLite::FLOAT)
+                return static_cast<Value>(column.getDouble());
+            if (type == SQLite::Null)
+                return Value{};
+        }
+        else if constexpr(std::is_enum_v<Value>)
+        {
+            return static_cast<Value>(column.getInt64());
+        }
+        return getColumnValue<Value>(column);
+    }
+
+    template<typename... Values>
+    static void checkColumnTypes(std::span<const google::protobuf::FieldDescriptor* const> fields)
+    {
+        size_t index = 0;
+        auto check = [&fields, &index](bool isCompatible, bool isNumeric) {
+            const auto* field = fields[index++];
+            const bool isText = field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_STRING;
+            if (!isCompatible && !(isNumeric && !isText))
+                throw std::logic_error("buffer of incompatible type for field " + field->name());
+        };
+        (check(isCompatible<Values>(fields[index]), std::is_arithmetic_v<Values>), ...);
+    }
+
+    template<typename... Values>
+    size_t readColumnValues(const google::protobuf::Descriptor* descriptor, std::span<const google::protobuf::FieldDescriptor* const> fields,
+                            int64_t& lastId, size_t capacity, Values*... columns) const
+    {
+        if (capacity == 0)
+            return 0;
+
+        auto query = selectColumns(descriptor, fields, lastId, capacity);
+        size_t row = 0;
+        while (query->executeStep())
+        {
+            int index = 1;
+            ((columns[row] = getCellValue<Values>(query->getColumn(index++))), ...);
+            lastId = query->getColumn(0).getInt64();
+            ++row;
+        }
+        return row;
+    }
+
+    template<typename Value>
+    static void bindValue(SQLite::Statement& query, int index, const Value& value)
+    {
+        if constexpr(std::is_same_v<Value, bool>)
+            query.bind(index, value ? 1 : 0);
+        else if constexpr(std::is_enum_v<Value>)
+            query.bind(index, static_cast<int>(value));
+        else if constexpr(std::is_integral_v<Value> && sizeof(Value) > sizeof(int32_t))
+            query.bind(index, static_cast<int64_t>(value));
+        else if constexpr(std::is_floating_point_v<Value>)
+            query.bind(index, static_cast<double>(value));
+        else
+            query.bind(index, value);
+    }
+
+    const TablePlan::ChildTable& getChildTable(const google::protobuf::Descriptor* descriptor, const google::protobuf::FieldDescriptor* field) const;
+    void appendElements(const TablePlan::ChildTable& table, int64_t id, size_t count, const std::function<void(SQLite::Statement&, int, size_t)>& bindElement) const;
+
     void createTable(const google::protobuf::Descriptor* reflection);
     void createTableImpl(const google::protobuf::Descriptor* reflection, bool uniqueObjects = false);
 
     int64_t writeMessageImpl(const google::protobuf::Message& message, bool handleConficts) const;
+    std::vector<int64_t> writeMessagesImpl(std::span<const google::protobuf::Message* const> messages, bool handleConficts) const;
+    void insertRows(const TablePlan& plan, std::span<const google::protobuf::Message* const> messages, std::vector<int64_t>& ids) const;
+    void writeChildren(const TablePlan& plan, const google::protobuf::Message& message, int64_t id, bool isUpdate) const;
+
+    template<typename Range>
+    static std::vector<const google::protobuf::Message*> getMessagePointers(const Range& messages)
+    {
+        std::vector<const google::protobuf::Message*> res;
+        if constexpr(requires { std::size(messages); })
+            res.reserve(std::size(messages));
+        for (const auto& message : messages)
+        {
+            if constexpr(std::is_pointer_v<std::decay_t<decltype(message)>>)
+                res.emplace_back(message);
+            else
+                res.emplace_back(&message);
+        }
+        return res;
+    }
 
     void deleteMessageImpl(const google::protobuf::Message& message);
 
-    void createMapTable(const google::protobuf::Descriptor*, const google::protobuf::FieldDescriptor* field);
-    void createArrayTable(const google::protobuf::Descriptor*, const google::protobuf::FieldDescriptor* field);
+    void createMapTable(const TablePlan& plan, const TablePlan::ChildTable& table);
+    void createArrayTable(const TablePlan& plan, const TablePlan::ChildTable& table);
+
+    const TablePlan& getPlan(const google::protobuf::Descriptor* descriptor) const;
+    const Projection& getProjection(const google::protobuf::Descriptor* descriptor, std::span<const google::protobuf::FieldDescriptor* const> fields) const;
+    static std::vector<const google::protobuf::FieldDescriptor*> getMaskFields(const google::protobuf::Descriptor* descriptor, const google::protobuf::FieldMask& mask);
+    std::unique_ptr<TablePlan> compilePlan(const google::protobuf::Descriptor* descriptor) const;
+    TablePlan::Column compileColumn(const google::protobuf::FieldDescriptor* field, int index) const;
 
-    bool isKey(const google::protobuf::FieldDescriptor* field);
+    static bool isKey(const google::protobuf::FieldDescriptor* field);
+    static bool isIndexed(const google::protobuf::FieldDescriptor* field);
+    void checkLookupField(const google::protobuf::Descriptor* descriptor, const google::protobuf::FieldDescriptor* field) const;
 
-    SQLite::Statement getAllObjects(const std::string& type) const;
+    StatementCache::Handle getAllObjects(const google::protobuf::Descriptor* descriptor) const;
     std::optional<int64_t> findMessage(const google::protobuf::Message& message) const;
 
     void findMessage(const std::string& type, int64_t id, google::protobuf::Message* message) const;
-    std::vector<int64_t> findAssociatedMessages(const std::string& type, int64_t owner) const;
+    void readFields(SQLite::Statement& query, google::protobuf::Message* message, int offset = 0, ReadMode mode = ReadMode::Eager) const;
+    void readProjection(SQLite::Statement& query, google::protobuf::Message* message, const Projection& projection) const;
+    void readColumns(SQLite::Statement& query, google::protobuf::Message* message, const std::vector<TablePlan::Column>& columns, int offset = 0) const;
+    void readMap(google::protobuf::Message* message, const TablePlan::ChildTable& table, int64_t id) const;
+    void readArray(google::protobuf::Message* message, const TablePlan::ChildTable& table, int64_t id) const;
+    void readEntry(SQLite::Statement& query, google::protobuf::Message* message, const TablePlan::ChildTable& table, int offset = 0) const;
+    void readElement(SQLite::Statement& query, google::protobuf::Message* message, const TablePlan::ChildTable& table, int offset = 0) const;
+
+    std::vector<std::optional<int64_t>> findMessages(std::span<const google::protobuf::Message* const> messages) const;
+    void findRows(const TablePlan& plan, const google::protobuf::FieldDescriptor* field, std::span<const size_t> positions,
+                  const std::function<void(SQLite::Statement&, int, size_t)>& bindKey,
+                  const std::function<google::protobuf::Message*(size_t)>& createMessage) const;
+    void readChildren(const TablePlan& plan, std::span<const std::pair<int64_t, google::protobuf::Message*>> rows) const;
+    void readRow(SQLite::Statement& query, google::protobuf::Message* message, const TablePlan& plan, int offset = 0) const;
 
-    void readFields(SQLite::Statement& query, google::protobuf::Message* message) const;
+    std::vector<int64_t> scanRows(const google::protobuf::Descriptor* descriptor, const google::protobuf::FieldDescriptor* field,
+                                  const std::function<void(SQLite::Statement&, int)>& bindFrom,
+                                  const std::function<void(SQLite::Statement&, int)>& bindTo,
+                                  const ScanOptions& options, std::string& resumeToken,
+                                  const std::function<google::protobuf::Message*()>& createMessage) const;
 
-    std::string getFieldType(const google::protobuf::FieldDescriptor* field);
+    void checkFieldPath(const google::protobuf::Descriptor* descriptor, const FieldPath& path) const;
+    std::string compileQuery(const google::protobuf::Descriptor* descriptor, const QueryFilter& filter, const QueryAggregate* aggregate = nullptr) const;
+    std::vector<int64_t> selectRows(const google::protobuf::Descriptor* descriptor, const QueryFilter& filter,
+                                    const std::function<google::protobuf::Message*()>& createMessage) const;
+    int64_t countRows(const google::protobuf::Descriptor* descriptor) const;
+    StatementCache::Handle selectColumns(const google::protobuf::Descriptor* descriptor, std::span<const google::protobuf::FieldDescriptor* const> fields,
+                                         int64_t lastId, size_t limit) const;
+    StatementCache::Handle selectAggregate(const google::protobuf::Descriptor* descriptor, const QueryFilter& filter, const QueryAggregate& aggregate) const;
 
-    std::vector<const google::protobuf::FieldDescriptor*> getMessageKeys(const google::protobuf::Message& message, bool strict = false) const;
-    void insertMessageFields(SQLite::Statement& query, const google::protobuf::Message& message, const std::vector<const google::protobuf::FieldDescriptor*>& fields, bool isInsertion, size_t offset = 0) const;
-    void insertMessageRepeatedField(SQLite::Statement& query, const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field, bool isInsertion) const;
+    static std::string getFieldType(const google::protobuf::FieldDescriptor* field);
 
-    void writeMap(const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field, int64_t id) const;
-    void removeMap(const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field, int64_t id) const;
+    const std::vector<TablePlan::Column>& getMessageKeys(const google::protobuf::Message& message, bool strict = false) const;
+    void insertMessageFields(SQLite::Statement& query, const google::protobuf::Message& message, const std::vector<TablePlan::Column>& columns, bool isInsertion, size_t offset = 0, bool handleConficts = false) const;
+    void insertMessageRepeatedField(SQLite::Statement& query, const google::protobuf::Message& message, const TablePlan::ChildTable& table, int index, bool isInsertion) const;
 
-    void writeArray(const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field, int64_t id) const;
-    void removeArray(const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field, int64_t id) const;
+    void writeMap(const google::protobuf::Message& message, const TablePlan::ChildTable& table, int64_t id) const;
+    void updateMap(const google::protobuf::Message& message, const TablePlan::ChildTable& table, int64_t id) const;
+    void removeMap(const TablePlan::ChildTable& table, int64_t id) const;
+
+    void writeArray(const google::protobuf::Message& message, const TablePlan::ChildTable& table, int64_t id) const;
+    void insertArray(const google::protobuf::Message& message, const TablePlan::ChildTable& table, int64_t id, int begin) const;
+    void updateArray(const google::protobuf::Message& message, const TablePlan::ChildTable& table, int64_t id) const;
+    std::vector<int64_t> readStoredElements(google::protobuf::Message* stored, const TablePlan::ChildTable& table, int64_t id, std::vector<int64_t>& nestedRows) const;
+    int64_t updateNestedMessage(const google::protobuf::Message& message, int64_t storedId) const;
+    void updateRow(const TablePlan& plan, const google::protobuf::Message& message, int64_t id) const;
+    void removeArray(const TablePlan::ChildTable& table, int64_t id) const;
 
     void clearTableImpl(const std::string& type);
 
@@ -251,6 +1175,18 @@ private:
 
 private:
     SQLite::Database database;
+    mutable StatementCache statements;
+    mutable std::unordered_map<const google::protobuf::Descriptor*, std::unique_ptr<const TablePlan>> plans;
+    mutable std::map<std::pair<const google::protobuf::Descriptor*, std::vector<int>>, std::unique_ptr<const Projection>> projections;
+    MessageCache messageCache;
+    size_t transactionDepth = 0;
+
+    bool statsEnabled = false;
+    mutable DatabaseStats stats;
+    int64_t changesBase = 0;
 };
 
 }
+
+#include <ProtoDatabase/MessageCursor.h>
+#include <ProtoDatabase/Query.h>
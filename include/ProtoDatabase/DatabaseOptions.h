@@ -0,0 +1,71 @@
+#pragma once
+
+#include <ProtoDatabase/StatementCache.h>
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+
+namespace ProtoDatabase
+{
+
+/**
+ * @brief The DatabaseOptions struct
+ *
+ * Settings of the connection applied when the database is opened. Unset values keep SQLite defaults
+ */
+struct DatabaseOptions
+{
+    enum class JournalMode
+    {
+        Default,
+        Delete,
+        Truncate,
+        Persist,
+        Memory,
+        Wal,
+        Off
+    };
+
+    enum class Synchronous
+    {
+        Default,
+        Off,
+        Normal,
+        Full,
+        Extra
+    };
+
+    enum class TempStore
+    {
+        Default,
+        File,
+        Memory
+    };
+
+    JournalMode journalMode = JournalMode::Default;
+    Synchronous synchronous = Synchronous::Default;
+    TempStore tempStore = TempStore::Default;
+
+    // number of pages if positive, size in KiB if negative
+    std::optional<int64_t> cacheSize;
+    std::optional<int64_t> mmapSize;
+    // takes effect only for a new database or after VACUUM, it can't be changed in WAL mode
+    std::optional<int> pageSize;
+
+    std::chrono::milliseconds busyTimeout{ 0 };
+
+    size_t statementCacheCapacity = StatementCache::defaultCapacity;
+
+    // max number of bytes of messages found by keys and kept in memory, 0 disables the cache
+    size_t messageCacheCapacity = 0;
+
+    // metrics are collected from the start, see Database::getStats()
+    bool collectStats = false;
+
+    // the connection is opened read-only, the database has to exist
+    bool readOnly = false;
+};
+
+}
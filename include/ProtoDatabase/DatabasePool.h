@@ -0,0 +1,199 @@
+#pragma once
+
+#include <ProtoDatabase/Database.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+
+namespace ProtoDatabase
+{
+
+/**
+ * @brief The DatabasePool class
+ *
+ * Thread-safe set of connections to one database file in WAL mode: a single writer and several read-only connections,
+ * so readers don't wait for each other or for the writer
+ */
+class EXPORT_ProtoDatabase DatabasePool
+{
+public:
+    /**
+     * @brief The Reader class
+     *
+     * Lease of a read-only connection, the connection returns to the pool when the lease is destroyed
+     */
+    class EXPORT_ProtoDatabase Reader
+    {
+    public:
+        Reader(Reader&& other) noexcept;
+        Reader& operator=(Reader&& other) noexcept;
+        ~Reader();
+
+        Database& operator*() const { return *database; }
+        Database* operator->() const { return database; }
+
+    private:
+        friend class DatabasePool;
+
+        Reader(DatabasePool& pool, Database* database);
+
+        void release() noexcept;
+
+    private:
+        DatabasePool* pool;
+        Database* database;
+    };
+
+    /**
+     * @brief The Writer class
+     *
+     * Exclusive access to the writing connection for the lifetime of the object
+     */
+    class EXPORT_ProtoDatabase Writer
+    {
+    public:
+        Database& operator*() const { return *database; }
+        Database* operator->() const { return database; }
+
+    private:
+        friend class DatabasePool;
+
+        Writer(std::mutex& mutex, Database* database) : lock(mutex), database(database)
+        {}
+
+    private:
+        std::unique_lock<std::mutex> lock;
+        Database* database;
+    };
+
+    /**
+     * @brief DatabasePool
+     * @param path - path to the database file, it's created if it doesn't exist
+     * @param readers - number of read-only connections
+     * @param options - settings of connections, journal is always switched to WAL
+     */
+    DatabasePool(const std::string& path, size_t readers, const DatabaseOptions& options = DatabaseOptions{});
+
+    /**
+     * @brief acquireReader
+     *
+     * Waits until one of read-only connections is free
+     *
+     * @return lease of the connection
+     */
+    Reader acquireReader();
+
+    /**
+     * @brief acquireWriter
+     *
+     * Waits until the writing connection is free. Explicit transactions and operations without shortcuts in the pool
+     * are done through the writer
+     *
+     * @return lease of the connection
+     */
+    Writer acquireWriter();
+
+    template<typename T>
+    void createTable()
+    {
+        acquireWriter()->createTable<T>();
+    }
+
+    void createTable(const google::protobuf::Message& message);
+
+    int64_t insertMessage(const google::protobuf::Message& message);
+    int64_t writeMessage(const google::protobuf::Message& message);
+
+    std::vector<int64_t> insertMessages(std::span<const google::protobuf::Message* const> messages);
+    std::vector<int64_t> writeMessages(std::span<const google::protobuf::Message* const> messages);
+
+    template<typename Range>
+    std::vector<int64_t> insertMessages(const Range& messages)
+    {
+        return acquireWriter()->insertMessages(messages);
+    }
+
+    template<typename Range>
+    std::vector<int64_t> writeMessages(const Range& messages)
+    {
+        return acquireWriter()->writeMessages(messages);
+    }
+
+    template<typename Message, typename Key>
+    void deleteMessage(const google::protobuf::FieldDescriptor* field, const Key& key)
+    {
+        acquireWriter()->deleteMessage<Message>(field, key);
+    }
+
+    void deleteMessage(const google::protobuf::Message& message);
+
+    template<typename Message, typename Key, typename Value>
+    size_t appendRepeated(const google::protobuf::FieldDescriptor* keyField, const Key& key, const google::protobuf::FieldDescriptor* field, std::span<const Value> values)
+    {
+        return acquireWriter()->appendRepeated<Message>(keyField, key, field, values);
+    }
+
+    void clearTable(const std::string& type);
+
+    template<typename T>
+    void clearTable()
+    {
+        clearTable(T::GetDescriptor()->name());
+    }
+
+    template<typename Message, typename Key>
+    std::optional<Message> findMessage(const google::protobuf::FieldDescriptor* field, const Key& key)
+    {
+        return acquireReader()->findMessage<Message>(field, key);
+    }
+
+    template<typename Message, typename Key>
+    std::vector<std::optional<Message>> findMessages(const google::protobuf::FieldDescriptor* field, std::span<const Key> keys)
+    {
+        return acquireReader()->findMessages<Message>(field, keys);
+    }
+
+    template<typename Message>
+    std::vector<Message> getAllMessages()
+    {
+        return acquireReader()->getAllMessages<Message>();
+    }
+
+    template<typename Value, typename Message>
+    std::vector<Value> getValue(const google::protobuf::FieldDescriptor* field)
+    {
+        return acquireReader()->getValue<Value, Message>(field);
+    }
+
+    template<typename Message, typename... Values>
+    size_t getColumns(const std::array<const google::protobuf::FieldDescriptor*, sizeof...(Values)>& fields, std::vector<Values>&... columns)
+    {
+        return acquireReader()->getColumns<Message>(fields, columns...);
+    }
+
+    template<typename Message, typename... Values>
+    size_t getColumns(const std::array<const google::protobuf::FieldDescriptor*, sizeof...(Values)>& fields, int64_t& lastId, size_t capacity, Values*... columns)
+    {
+        return acquireReader()->getColumns<Message>(fields, lastId, capacity, columns...);
+    }
+
+private:
+    void release(Database* reader) noexcept;
+
+private:
+    std::mutex writerMutex;
+    Database writer;
+
+    std::mutex readersMutex;
+    std::condition_variable readerReleased;
+    std::vector<std::unique_ptr<Database>> readers;
+    std::vector<Database*> idleReaders;
+};
+
+}
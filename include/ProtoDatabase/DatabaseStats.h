@@ -0,0 +1,121 @@
+#pragma once
+
+#include <ProtoDatabase/MessageCache.h>
+#include <ProtoDatabase/StatementCache.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+
+namespace ProtoDatabase
+{
+
+/**
+ * @brief The LatencyHistogram struct
+ *
+ * Durations grouped by powers of two of nanoseconds
+ */
+struct EXPORT_ProtoDatabase LatencyHistogram
+{
+    // bucket i keeps durations shorter than 2^i ns, the last one keeps all longer durations
+    static constexpr size_t bucketCount = 40;
+
+    std::array<uint64_t, bucketCount> buckets{};
+    uint64_t count = 0;
+    std::chrono::nanoseconds total{ 0 };
+    std::chrono::nanoseconds max{ 0 };
+
+    void record(std::chrono::nanoseconds duration);
+
+    /**
+     * @brief getPercentile
+     * @param rank - value from 0 to 1
+     * @return upper bound of the bucket containing the percentile
+     */
+    std::chrono::nanoseconds getPercentile(double rank) const;
+
+    std::chrono::nanoseconds getMean() const;
+};
+
+/**
+ * @brief The DatabaseStats struct
+ *
+ * Snapshot of metrics collected by the database while they are enabled
+ */
+struct EXPORT_ProtoDatabase DatabaseStats
+{
+    enum class Operation
+    {
+        CreateTable,
+        InsertMessage,
+        WriteMessage,
+        InsertMessages,
+        WriteMessages,
+        FindMessage,
+        FindAllMessages,
+        FindMessages,
+        GetAllMessages,
+        ScanMessages,
+        ScanRange,
+        QueryMessages,
+        Aggregate,
+        GetValue,
+        GetColumns,
+        DeleteMessage,
+        AppendRepeated,
+        ClearTable
+    };
+
+    static constexpr size_t operationCount = static_cast<size_t>(Operation::ClearTable) + 1;
+
+    // latency of public calls
+    std::array<LatencyHistogram, operationCount> operations;
+    // latency of commits of outermost transactions
+    LatencyHistogram commits;
+
+    uint64_t statements = 0;
+    uint64_t rowsRead = 0;
+    uint64_t rowsWritten = 0;
+
+    // misses of the cache are statements prepared by the connection
+    StatementCache::Stats statementCache;
+    MessageCache::Stats messageCache;
+
+    const LatencyHistogram& getOperation(Operation operation) const
+    {
+        return operations[static_cast<size_t>(operation)];
+    }
+
+    static const char* getOperationName(Operation operation);
+};
+
+/**
+ * @brief The ScopedTimer class
+ *
+ * Records time from its creation to destruction into the histogram, does nothing without histogram
+ */
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(LatencyHistogram* histogram) : histogram(histogram)
+    {
+        if (histogram)
+            start = std::chrono::steady_clock::now();
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    ~ScopedTimer()
+    {
+        if (histogram)
+            histogram->record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start));
+    }
+
+private:
+    LatencyHistogram* histogram;
+    std::chrono::steady_clock::time_point start;
+};
+
+}
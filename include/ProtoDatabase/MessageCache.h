@@ -0,0 +1,171 @@
+#pragma once
+
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/message.h>
+
+#include <bit>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+
+
+namespace ProtoDatabase
+{
+
+/**
+ * @brief The MessageCache class
+ *
+ * Copies of messages found by key fields kept in order of use and bounded by memory used by the messages.
+ * Entries of a type are dropped when a type sharing any nested type with it (including the type itself) is changed
+ */
+class EXPORT_ProtoDatabase MessageCache
+{
+public:
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        uint64_t invalidations = 0;
+        size_t entries = 0;
+        size_t size = 0;
+        size_t capacity = 0;
+    };
+
+    /**
+     * @brief MessageCache
+     * @param capacity - max number of bytes used by cached messages, 0 disables caching
+     */
+    explicit MessageCache(size_t capacity = 0);
+
+    bool isEnabled() const
+    {
+        return capacity > 0;
+    }
+
+    template<typename Key>
+    std::shared_ptr<const google::protobuf::Message> find(const google::protobuf::FieldDescriptor* field, const Key& key)
+    {
+        if (!isEnabled())
+            return {};
+        return findEncoded(field, encodeKey(key));
+    }
+
+    template<typename Key>
+    void insert(const google::protobuf::FieldDescriptor* field, const Key& key, const google::protobuf::Message& message)
+    {
+        if (!isEnabled())
+            return;
+        insertEncoded(field, encodeKey(key), message);
+    }
+
+    /**
+     * @brief registerType
+     *
+     * Remembers types nested into the type, so the type can be found by its name on invalidation
+     * even if its messages have never been cached
+     */
+    void registerType(const google::protobuf::Descriptor* descriptor);
+
+    /**
+     * @brief invalidate
+     *
+     * Drops entries of all types which reach any type reachable from the changed one
+     */
+    void invalidate(const google::protobuf::Descriptor* descriptor);
+
+    /**
+     * @brief invalidate
+     *
+     * Drops entries related to registered types with the name, all entries are dropped if no such type is known
+     */
+    void invalidate(const std::string& typeName);
+
+    void setCapacity(size_t capacity);
+    void clear();
+
+    Stats getStats() const;
+    void resetStats();
+
+private:
+    struct Key
+    {
+        const google::protobuf::FieldDescriptor* field;
+        std::string value;
+
+        bool operator==(const Key&) const = default;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const noexcept;
+    };
+
+    struct Entry
+    {
+        Key key;
+        std::shared_ptr<const google::protobuf::Message> message;
+        size_t size = 0;
+    };
+
+    template<typename Value>
+    static std::string encodeKey(const Value& key)
+    {
+        if constexpr(std::is_base_of_v<google::protobuf::Message, Value>)
+        {
+            // equal maps have to produce equal keys regardless of order of their entries
+            std::string res;
+            {
+                google::protobuf::io::StringOutputStream stream(&res);
+                google::protobuf::io::CodedOutputStream output(&stream);
+                output.SetSerializationDeterministic(true);
+                key.SerializeToCodedStream(&output);
+            }
+            return res;
+        }
+        else if constexpr(std::is_convertible_v<const Value&, std::string>)
+        {
+            return std::string(key);
+        }
+        else if constexpr(std::is_floating_point_v<Value>)
+        {
+            // text of std::to_string is rounded to 6 decimal places, so distinct values are encoded by their bits
+            const auto bits = std::bit_cast<uint64_t>(static_cast<double>(key));
+            return std::string(reinterpret_cast<const char*>(&bits), sizeof(bits));
+        }
+        else
+        {
+            return std::to_string(key);
+        }
+    }
+
+    std::shared_ptr<const google::protobuf::Message> findEncoded(const google::protobuf::FieldDescriptor* field, std::string key);
+    void insertEncoded(const google::protobuf::FieldDescriptor* field, std::string key, const google::protobuf::Message& message);
+
+    void erase(std::list<Entry>::iterator entry);
+    void shrink();
+
+    bool isRelated(const google::protobuf::Descriptor* cached, const google::protobuf::Descriptor* changed);
+    const std::unordered_set<const google::protobuf::Descriptor*>& getNestedTypes(const google::protobuf::Descriptor* descriptor);
+
+private:
+    size_t capacity;
+    size_t size = 0;
+
+    std::list<Entry> recentlyUsed;
+    std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> entries;
+    std::unordered_map<const google::protobuf::Descriptor*, size_t> typeEntries;
+    std::unordered_map<const google::protobuf::Descriptor*, std::unordered_set<const google::protobuf::Descriptor*>> nestedTypes;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    uint64_t invalidations = 0;
+};
+
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <ProtoDatabase/Database.h>
+
+#include <cstddef>
+#include <iterator>
+
+
+namespace ProtoDatabase
+{
+
+/**
+ * @brief The MessageCursor class
+ *
+ * Lazy sequence of stored messages of one type. Rows are decoded one by one while the cursor is iterated,
+ * so memory usage doesn't depend on the size of the table
+ */
+template<typename Message>
+class MessageCursor
+{
+public:
+    class Iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = Message;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Message*;
+        using reference = const Message&;
+
+        Iterator() = default;
+
+        reference operator*() const { return cursor->current(); }
+        pointer operator->() const { return &cursor->current(); }
+
+        Iterator& operator++()
+        {
+            if (!cursor->next())
+                cursor = nullptr;
+            return *this;
+        }
+
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const { return cursor == nullptr; }
+
+    private:
+        friend class MessageCursor;
+
+        explicit Iterator(MessageCursor* cursor) : cursor(cursor) {}
+
+    private:
+        MessageCursor* cursor = nullptr;
+    };
+
+    /**
+     * @brief MessageCursor
+     * @param database - source of messages
+     * @param query - statement selecting rows of the message table
+     * @param reuse - message filled by every step instead of the message owned by the cursor, it may be nullptr
+     * @param mode - lazy mode leaves nested messages, repeated and map fields to Database::loadField()
+     */
+    MessageCursor(const Database& database, StatementCache::Handle query, Message* reuse = nullptr, ReadMode mode = ReadMode::Eager) :
+        database(&database),
+        query(std::move(query)),
+        reuse(reuse),
+        mode(mode)
+    {}
+
+    MessageCursor(MessageCursor&&) = default;
+    MessageCursor& operator=(MessageCursor&&) = default;
+
+    /**
+     * @brief next
+     *
+     * Decodes the next row into the current message
+     *
+     * @return false if there are no more rows
+     */
+    bool next()
+    {
+        if (!query->executeStep())
+            return false;
+
+        auto* message = reuse ? reuse : &owned;
+        message->Clear();
+        database->readFields(*query, message, 0, mode);
+        return true;
+    }
+
+    /**
+     * @brief current
+     * @return message decoded by the last successful call of next()
+     */
+    const Message& current() const
+    {
+        return reuse ? *reuse : owned;
+    }
+
+    /**
+     * @brief getId
+     * @return ID of the row of the current message
+     */
+    int64_t getId() const
+    {
+        return query->getColumn(0).getInt64();
+    }
+
+    /**
+     * @brief begin
+     *
+     * Steps to the first row. The cursor can be iterated only once
+     */
+    Iterator begin()
+    {
+        return next() ? Iterator{ this } : Iterator{};
+    }
+
+    std::default_sentinel_t end() const
+    {
+        return {};
+    }
+
+private:
+    const Database* database;
+    StatementCache::Handle query;
+    Message* reuse;
+    ReadMode mode;
+    Message owned;
+};
+
+}
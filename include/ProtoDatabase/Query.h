@@ -0,0 +1,333 @@
+#pragma once
+
+#include <ProtoDatabase/Database.h>
+
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+
+namespace ProtoDatabase
+{
+
+/**
+ * @brief The Op enum
+ *
+ * Comparison of the value of a field with the value of a condition, Like compares text with SQL LIKE pattern
+ */
+enum class Op
+{
+    Eq,
+    Ne,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    Like
+};
+
+/**
+ * @brief The Aggregate enum
+ *
+ * SQL aggregate function computed over values of a field
+ */
+enum class Aggregate
+{
+    Count,
+    Sum,
+    Min,
+    Max,
+    Avg
+};
+
+/**
+ * @brief The QueryFilter struct
+ *
+ * Conditions and order of a query with values hidden behind bind functions, Database compiles it to SQL
+ */
+struct QueryFilter
+{
+    struct Condition
+    {
+        FieldPath path;
+        Op op = Op::Eq;
+        std::function<void(SQLite::Statement&, int)> bind;
+    };
+
+    struct Order
+    {
+        FieldPath path;
+        ScanOrder order = ScanOrder::Ascending;
+    };
+
+    std::vector<Condition> conditions;
+    std::vector<Order> orders;
+    // 0 means no limit
+    size_t limit = 0;
+    size_t offset = 0;
+};
+
+/**
+ * @brief The QueryAggregate struct
+ *
+ * Function over values of the field, the whole row is counted if the path is empty.
+ * Rows are split into groups by values of the second field if its path isn't empty
+ */
+struct QueryAggregate
+{
+    Aggregate function = Aggregate::Count;
+    FieldPath path;
+    FieldPath groupBy;
+};
+
+/**
+ * @brief The Query class
+ *
+ * Typed builder of a request selecting messages by conditions on their fields. All conditions are joined by AND
+ * and checked by SQLite, nested messages of the path are joined to the row of the message
+ */
+template<typename Message>
+class Query
+{
+public:
+    explicit Query(const Database& database) : database(&database)
+    {}
+
+    /**
+     * @brief where
+     * @param field - field of the message stored in a column
+     * @param op - comparison
+     * @param value - value compared with the field
+     */
+    template<typename Value>
+    Query& where(const google::protobuf::FieldDescriptor* field, Op op, const Value& value)
+    {
+        return where(FieldPath{ field }, op, value);
+    }
+
+    /**
+     * @brief where
+     * @param path - singular message fields leading to the compared field
+     * @param op - comparison
+     * @param value - value compared with the field
+     */
+    template<typename Value>
+    Query& where(const FieldPath& path, Op op, const Value& value)
+    {
+        database->checkFieldPath(Message::GetDescriptor(), path);
+
+        // text is copied, so literals and temporary strings can be passed
+        using Stored = std::conditional_t<std::is_convertible_v<const Value&, std::string>, std::string, Value>;
+        if (!Database::isCompatible<Stored>(path.back()))
+            throw std::logic_error("value of incompatible type for field " + path.back()->name());
+        if (op == Op::Like && path.back()->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_STRING)
+            throw std::logic_error("pattern match of not string field " + path.back()->name());
+
+        filter.conditions.push_back({ path, op, [value = Stored(value)](SQLite::Statement& query, int index) {
+            Database::bindValue(query, index, value);
+        } });
+        return *this;
+    }
+
+    /**
+     * @brief orderBy
+     *
+     * Several orders are applied one after another, messages with equal values are kept in order of insertion
+     *
+     * @param field - field of the message stored in a column
+     * @param order - direction of sorting
+     */
+    Query& orderBy(const google::protobuf::FieldDescriptor* field, ScanOrder order = ScanOrder::Ascending)
+    {
+        return orderBy(FieldPath{ field }, order);
+    }
+
+    /**
+     * @brief orderBy
+     * @param path - singular message fields leading to the field of sorting
+     * @param order - direction of sorting
+     */
+    Query& orderBy(const FieldPath& path, ScanOrder order = ScanOrder::Ascending)
+    {
+        database->checkFieldPath(Message::GetDescriptor(), path);
+        filter.orders.push_back({ path, order });
+        return *this;
+    }
+
+    /**
+     * @brief limit
+     * @param count - max number of messages, 0 means no limit
+     */
+    Query& limit(size_t count)
+    {
+        filter.limit = count;
+        return *this;
+    }
+
+    /**
+     * @brief offset
+     * @param count - number of skipped messages
+     */
+    Query& offset(size_t count)
+    {
+        filter.offset = count;
+        return *this;
+    }
+
+    /**
+     * @brief getMessages
+     * @return messages matching all conditions
+     */
+    std::vector<Message> getMessages() const
+    {
+        return getMessages(filter);
+    }
+
+    /**
+     * @brief getFirstMessage
+     * @return the first message matching all conditions
+     */
+    std::optional<Message> getFirstMessage() const
+    {
+        auto first = filter;
+        first.limit = 1;
+        auto messages = getMessages(first);
+        if (messages.empty())
+            return std::nullopt;
+        return std::move(messages.front());
+    }
+
+    /**
+     * @brief getCount
+     * @return number of messages matching all conditions regardless of limit and offset
+     */
+    int64_t getCount() const
+    {
+        ScopedTimer timer(database->getHistogram(DatabaseStats::Operation::Aggregate));
+
+        auto query = database->selectAggregate(Message::GetDescriptor(), filter, QueryAggregate{});
+        query->executeStep();
+        return query->getColumn(0).getInt64();
+    }
+
+    /**
+     * @brief aggregate
+     *
+     * Computes the function over values of the field by one SQL aggregate, only conditions of the query are applied:
+     * order, limit and offset are ignored. Count requires integral type of the result and average floating point one
+     *
+     * @param function - aggregate function
+     * @param path - singular message fields leading to the aggregated field
+     * @return result of the function, empty optional if no messages match (count returns 0)
+     */
+    template<typename Value>
+    std::optional<Value> aggregate(Aggregate function, const FieldPath& path) const
+    {
+        checkAggregate<Value>(function, path);
+
+        ScopedTimer timer(database->getHistogram(DatabaseStats::Operation::Aggregate));
+
+        auto query = database->selectAggregate(Message::GetDescriptor(), filter, QueryAggregate{ function, path, {} });
+        if (!query->executeStep() || query->getColumn(0).isNull())
+            return std::nullopt;
+        return Database::getColumnValue<Value>(query->getColumn(0));
+    }
+
+    template<typename Value>
+    std::optional<Value> aggregate(Aggregate function, const google::protobuf::FieldDescriptor* field) const
+    {
+        return aggregate<Value>(function, FieldPath{ field });
+    }
+
+    /**
+     * @brief aggregateBy
+     *
+     * Computes the function separately for every value of the grouping field, see aggregate()
+     *
+     * @param function - aggregate function
+     * @param path - singular message fields leading to the aggregated field
+     * @param groupBy - singular message fields leading to the grouping field
+     * @return results of the function by values of the grouping field
+     */
+    template<typename Key, typename Value>
+    std::map<Key, Value> aggregateBy(Aggregate function, const FieldPath& path, const FieldPath& groupBy) const
+    {
+        checkAggregate<Value>(function, path);
+        database->checkFieldPath(Message::GetDescriptor(), groupBy);
+        if (!Database::isCompatible<Key>(groupBy.back()))
+            throw std::logic_error("key of incompatible type for field " + groupBy.back()->name());
+
+        ScopedTimer timer(database->getHistogram(DatabaseStats::Operation::Aggregate));
+
+        auto query = database->selectAggregate(Message::GetDescriptor(), filter, QueryAggregate{ function, path, groupBy });
+        std::map<Key, Value> res;
+        while (query->executeStep())
+        {
+            if (!query->getColumn(1).isNull())
+                res.emplace(Database::getColumnValue<Key>(query->getColumn(0)), Database::getColumnValue<Value>(query->getColumn(1)));
+        }
+        return res;
+    }
+
+    template<typename Key, typename Value>
+    std::map<Key, Value> aggregateBy(Aggregate function, const google::protobuf::FieldDescriptor* field, const google::protobuf::FieldDescriptor* groupBy) const
+    {
+        return aggregateBy<Key, Value>(function, FieldPath{ field }, FieldPath{ groupBy });
+    }
+
+private:
+    template<typename Value>
+    void checkAggregate(Aggregate function, const FieldPath& path) const
+    {
+        database->checkFieldPath(Message::GetDescriptor(), path);
+
+        const auto* field = path.back();
+        const bool isNumeric = field->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_STRING;
+        bool isValid = false;
+        switch (function)
+        {
+        case Aggregate::Count:
+            isValid = std::is_integral_v<Value>;
+            break;
+        case Aggregate::Sum:
+            isValid = isNumeric && (Database::isCompatible<Value>(field) || std::is_floating_point_v<Value>);
+            break;
+        case Aggregate::Avg:
+            isValid = isNumeric && std::is_floating_point_v<Value>;
+            break;
+        case Aggregate::Min:
+        case Aggregate::Max:
+            isValid = Database::isCompatible<Value>(field);
+            break;
+        }
+        if (!isValid)
+            throw std::logic_error("result of incompatible type for aggregate of field " + field->name());
+    }
+
+    std::vector<Message> getMessages(const QueryFilter& selection) const
+    {
+        ScopedTimer timer(database->getHistogram(DatabaseStats::Operation::QueryMessages));
+
+        std::vector<Message> res;
+        auto ids = database->selectRows(Message::GetDescriptor(), selection, [&res]() -> google::protobuf::Message* {
+            return &res.emplace_back();
+        });
+
+        std::vector<std::pair<int64_t, google::protobuf::Message*>> rows;
+        rows.reserve(ids.size());
+        for (size_t i = 0; i < ids.size(); ++i)
+            rows.emplace_back(ids[i], &res[i]);
+        database->readChildren(database->getPlan(Message::GetDescriptor()), rows);
+
+        return res;
+    }
+
+private:
+    const Database* database;
+    QueryFilter filter;
+};
+
+}
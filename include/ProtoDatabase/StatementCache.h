@@ -0,0 +1,173 @@
+#pragma once
+
+#include <SQLiteCpp/Database.h>
+#include <SQLiteCpp/Statement.h>
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+
+namespace ProtoDatabase
+{
+
+/**
+ * @brief The StatementCache class
+ *
+ * Keeps compiled statements of one connection keyed by descriptor (or field descriptor) and kind of operation,
+ * so repeated requests of the same shape are only rebound instead of being parsed again.
+ * Statements of queries built at run time are keyed by their SQL text
+ */
+class EXPORT_ProtoDatabase StatementCache
+{
+public:
+    enum class Operation
+    {
+        Insert,
+        InsertRows,
+        Upsert,
+        Update,
+        SelectAll,
+        SelectById,
+        SelectByKey,
+        SelectByKeys,
+        SelectIds,
+        SelectOwners,
+        SelectRange,
+        SelectQuery,
+        SelectId,
+        SelectOwned,
+        SelectColumn,
+        SelectCount,
+        Delete,
+        DeleteByKey,
+        DeleteOwned,
+        InsertElement,
+        UpdateElement,
+        DeleteElement
+    };
+
+    struct Key
+    {
+        const void* object;
+        Operation operation;
+        int64_t variant = 0;
+        // SQL text of a query built at run time, empty for statements of descriptors
+        std::string query = {};
+
+        bool operator==(const Key&) const = default;
+    };
+
+    struct Stats
+    {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t size = 0;
+        size_t capacity = 0;
+    };
+
+private:
+    struct Entry
+    {
+        Entry(const SQLite::Database& database, const std::string& query);
+
+        SQLite::Statement statement;
+        bool inUse = false;
+        std::list<Key>::iterator position;
+    };
+
+public:
+    /**
+     * @brief The Handle class
+     *
+     * Lease of a statement from the cache. The statement is reset and its bindings are cleared when the handle is destroyed
+     */
+    class EXPORT_ProtoDatabase Handle
+    {
+    public:
+        Handle(Handle&& other) noexcept = default;
+        Handle& operator=(Handle&& other) noexcept;
+        ~Handle();
+
+        SQLite::Statement& operator*() const { return entry->statement; }
+        SQLite::Statement* operator->() const { return &entry->statement; }
+
+    private:
+        friend class StatementCache;
+
+        explicit Handle(std::shared_ptr<Entry> entry);
+
+        void release() noexcept;
+
+    private:
+        std::shared_ptr<Entry> entry;
+    };
+
+    static constexpr size_t defaultCapacity = 256;
+
+    explicit StatementCache(const SQLite::Database& database, size_t capacity = defaultCapacity);
+
+    /**
+     * @brief acquire
+     * @param key - descriptor and operation the statement is compiled for
+     * @param buildQuery - callable returning SQL text, it's invoked only when the statement isn't cached yet
+     * @return lease of the statement ready for binding
+     */
+    template<typename QueryBuilder>
+    Handle acquire(const Key& key, QueryBuilder&& buildQuery)
+    {
+        if (auto entry = lookup(key))
+            return Handle{ std::move(entry) };
+        return prepare(key, buildQuery());
+    }
+
+    /**
+     * @brief acquire
+     * @param query - SQL text of the statement, it's compiled only when the statement isn't cached yet
+     * @return lease of the statement ready for binding
+     */
+    Handle acquire(const std::string& query);
+
+    /**
+     * @brief setCapacity
+     * @param capacity - max number of cached statements, 0 disables caching
+     */
+    void setCapacity(size_t capacity);
+
+    /**
+     * @brief clear
+     *
+     * Drops all cached statements
+     */
+    void clear();
+
+    Stats getStats() const;
+    void resetStats();
+
+private:
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const noexcept;
+    };
+
+    std::shared_ptr<Entry> lookup(const Key& key);
+    Handle prepare(const Key& key, const std::string& query);
+
+    void shrink();
+
+private:
+    const SQLite::Database& database;
+    size_t capacity;
+
+    std::unordered_map<Key, std::shared_ptr<Entry>, KeyHash> entries;
+    std::list<Key> recentlyUsed;
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
+
+}
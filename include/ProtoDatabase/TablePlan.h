@@ -0,0 +1,197 @@
+#pragma once
+
+#include <SQLiteCpp/Column.h>
+#include <SQLiteCpp/Statement.h>
+
+#include <google/protobuf/message.h>
+
+#include <string>
+#include <vector>
+
+
+namespace ProtoDatabase
+{
+
+/**
+ * @brief The TablePlan struct
+ *
+ * Layout of the table of one message type compiled once from its descriptor: columns, key fields,
+ * tables of repeated and map fields, SQL text of common requests and typed bind/read functions for every column
+ */
+struct EXPORT_ProtoDatabase TablePlan
+{
+    using BindFunction = void(*)(SQLite::Statement& query, int index, const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field);
+    using BindElementFunction = void(*)(SQLite::Statement& query, int index, const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field, int element);
+    using ReadFunction = void(*)(const SQLite::Column& column, google::protobuf::Message* message, const google::protobuf::FieldDescriptor* field);
+
+    struct Column
+    {
+        const google::protobuf::FieldDescriptor* field = nullptr;
+        std::string name;
+        std::string type;
+        int index = 0;
+        bool isKey = false;
+        // the column is the first one of an index, so the field can be used for lookups
+        bool isIndexed = false;
+
+        BindFunction bind = nullptr;
+        ReadFunction read = nullptr;
+    };
+
+    /**
+     * @brief The FieldAccessors struct
+     *
+     * Functions of one field working through accessors of the generated class instead of reflection,
+     * they are emitted by protoc-gen-protodb plugin and registered by register<File>Accessors() of the generated file
+     */
+    struct FieldAccessors
+    {
+        BindFunction bind = nullptr;
+        ReadFunction read = nullptr;
+        BindElementFunction bindElement = nullptr;
+        ReadFunction addElement = nullptr;
+    };
+
+    struct ChildTable
+    {
+        const google::protobuf::FieldDescriptor* field = nullptr;
+        std::string name;
+        bool isMap = false;
+
+        // element column of repeated field or key and value columns of map entry
+        std::vector<Column> columns;
+
+        BindElementFunction bindElement = nullptr;
+        ReadFunction addElement = nullptr;
+
+        std::string insertSql;
+        std::string insertRowsSql;
+        std::string rowValuesSql;
+        std::string deleteSql;
+
+        // statements of incremental update of stored elements: value of a map entry or an array element,
+        // a map entry, elements of an array starting from the row and IDs of rows of one owner in order
+        // with IDs of their nested messages
+        std::string updateSql;
+        std::string deleteElementSql;
+        std::string deleteTailSql;
+        std::string selectRowsSql;
+
+        // elements of one owner in order of insertion, nested messages are joined to the rows
+        std::string selectSql;
+
+        // elements of several owners with owner ID in the first column, the list of IDs is placed between the parts
+        std::string selectOwnersSql;
+        std::string selectOwnersOrderSql;
+
+        /**
+         * @brief getSelectOwnersSql
+         * @param owners - number of owners in IN list
+         * @return SQL text of selection of elements of several owners by one statement
+         */
+        std::string getSelectOwnersSql(size_t owners) const;
+
+        /**
+         * @brief getInsertSql
+         * @param rows - number of elements in VALUES list
+         * @return SQL text of insertion of several elements of an array by one statement
+         */
+        std::string getInsertSql(size_t rows) const;
+    };
+
+    const google::protobuf::Descriptor* descriptor = nullptr;
+    std::string tableName;
+
+    // the whole message is serialized into the last column, other columns are its keys
+    bool isBlob = false;
+
+    std::vector<Column> columns;
+    std::vector<Column> keyColumns;
+    std::vector<int> fieldColumns;
+    std::vector<ChildTable> children;
+
+    std::string insertSql;
+    std::string insertRowsSql;
+    std::string rowValuesSql;
+    std::string upsertSql;
+    std::string updateSql;
+    std::string selectAllSql;
+    std::string selectByIdSql;
+    std::string selectIdSql;
+    std::string deleteSql;
+    std::vector<std::string> indexSql;
+
+    /**
+     * @brief findColumn
+     * @param field - field of the message
+     * @return column of the field or nullptr if the field is stored in a separate table
+     */
+    const Column* findColumn(const google::protobuf::FieldDescriptor* field) const;
+
+    /**
+     * @brief getLookupColumns
+     * @return columns which identify an object: key columns or all data columns if the type has no keys
+     */
+    const std::vector<Column>& getLookupColumns() const;
+
+    /**
+     * @brief getInsertSql
+     * @param rows - number of rows in VALUES list
+     * @return SQL text of insertion of several rows by one statement returning IDs of the rows
+     */
+    std::string getInsertSql(size_t rows) const;
+
+    /**
+     * @brief registerAccessors
+     *
+     * The functions must fall back to reflection for messages which aren't instances of the generated class,
+     * dynamic messages of the type for example
+     *
+     * @param descriptor - type of the generated pool
+     * @param number - number of the field
+     * @param accessors - functions replacing reflection based ones
+     */
+    static void registerAccessors(const google::protobuf::Descriptor* descriptor, int number, const FieldAccessors& accessors);
+
+    /**
+     * @brief findAccessors
+     * @param field - field of the message
+     * @return registered generated functions of the field or nullptr
+     */
+    static const FieldAccessors* findAccessors(const google::protobuf::FieldDescriptor* field);
+
+    static BindFunction getBindFunction(const google::protobuf::FieldDescriptor* field);
+    static BindElementFunction getBindElementFunction(const google::protobuf::FieldDescriptor* field);
+    static ReadFunction getReadFunction(const google::protobuf::FieldDescriptor* field);
+    static ReadFunction getAddFunction(const google::protobuf::FieldDescriptor* field);
+
+    static BindFunction getReflectionBindFunction(const google::protobuf::FieldDescriptor* field);
+    static BindElementFunction getReflectionBindElementFunction(const google::protobuf::FieldDescriptor* field);
+    static ReadFunction getReflectionReadFunction(const google::protobuf::FieldDescriptor* field);
+    static ReadFunction getReflectionAddFunction(const google::protobuf::FieldDescriptor* field);
+
+    static BindFunction getSerializedBindFunction();
+    static ReadFunction getSerializedReadFunction();
+};
+
+/**
+ * @brief The Projection struct
+ *
+ * Subset of fields of a table plan read by one request: selected columns with their positions in the projected row
+ * and child tables to be loaded
+ */
+struct EXPORT_ProtoDatabase Projection
+{
+    const TablePlan* plan = nullptr;
+    std::vector<const google::protobuf::FieldDescriptor*> fields;
+
+    // ID of the row is the first column of the projected row
+    std::vector<TablePlan::Column> columns;
+    std::vector<const TablePlan::ChildTable*> children;
+
+    // SELECT with column list and table name without conditions
+    std::string selectSql;
+    std::string selectAllSql;
+};
+
+}
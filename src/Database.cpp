@@ -1,23 +1,236 @@
 #include <ProtoDatabase/Database.h>
 
-#include <SQLiteCpp/Transaction.h>
-
 #include <google/protobuf/descriptor.pb.h>
 #include <google/protobuf/map_field.h>
 #include <google/protobuf/repeated_ptr_field.h>
+#include <google/protobuf/util/message_differencer.h>
 
 #include <proto/KeyOption.pb.h>
 
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+
 
 namespace ProtoDatabase
 {
 
-Database::Database() : database(":memory:", SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE)
+namespace
+{
+
+// multi-row statements are cached for the max number of rows and for powers of two below it,
+// so batches of any size share a few statements
+size_t getChunkRows(size_t remaining, size_t maxRows)
+{
+    return remaining >= maxRows ? maxRows : std::bit_floor(remaining);
+}
+
+int traceStatement(unsigned type, void* context, void*, void* data)
+{
+    auto stats = static_cast<DatabaseStats*>(context);
+    if (type == SQLITE_TRACE_STMT)
+    {
+        // statements of triggers are reported with comments instead of SQL text
+        const char* sql = static_cast<const char*>(data);
+        if (!sql || std::strncmp(sql, "--", 2) != 0)
+            ++stats->statements;
+    }
+    else if (type == SQLITE_TRACE_ROW)
+    {
+        ++stats->rowsRead;
+    }
+    return 0;
+}
+
+bool equalElements(const google::protobuf::Message& first, const google::protobuf::Message& second, const google::protobuf::FieldDescriptor* field, int index)
+{
+    const auto* reflection = first.GetReflection();
+    switch (field->cpp_type())
+    {
+    case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
+        return reflection->GetRepeatedString(first, field, index) == reflection->GetRepeatedString(second, field, index);
+    case google::protobuf::FieldDescriptor::CPPTYPE_INT32:
+        return reflection->GetRepeatedInt32(first, field, index) == reflection->GetRepeatedInt32(second, field, index);
+    case google::protobuf::FieldDescriptor::CPPTYPE_INT64:
+        return reflection->GetRepeatedInt64(first, field, index) == reflection->GetRepeatedInt64(second, field, index);
+    case google::protobuf::FieldDescriptor::CPPTYPE_UINT32:
+        return reflection->GetRepeatedUInt32(first, field, index) == reflection->GetRepeatedUInt32(second, field, index);
+    case google::protobuf::FieldDescriptor::CPPTYPE_UINT64:
+        return reflection->GetRepeatedUInt64(first, field, index) == reflection->GetRepeatedUInt64(second, field, index);
+    case google::protobuf::FieldDescriptor::CPPTYPE_BOOL:
+        return reflection->GetRepeatedBool(first, field, index) == reflection->GetRepeatedBool(second, field, index);
+    case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE:
+        return reflection->GetRepeatedDouble(first, field, index) == reflection->GetRepeatedDouble(second, field, index);
+    case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT:
+        return reflection->GetRepeatedFloat(first, field, index) == reflection->GetRepeatedFloat(second, field, index);
+    case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
+        return reflection->GetRepeatedEnumValue(first, field, index) == reflection->GetRepeatedEnumValue(second, field, index);
+    case google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE:
+        return google::protobuf::util::MessageDifferencer::Equals(reflection->GetRepeatedMessage(first, field, index), reflection->GetRepeatedMessage(second, field, index));
+    }
+    return false;
+}
+
+bool equalValues(const google::protobuf::Message& first, const google::protobuf::Message& second, const google::protobuf::FieldDescriptor* field)
+{
+    const auto* reflection = first.GetReflection();
+    switch (field->cpp_type())
+    {
+    case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
+        return reflection->GetString(first, field) == reflection->GetString(second, field);
+    case google::protobuf::FieldDescriptor::CPPTYPE_INT32:
+        return reflection->GetInt32(first, field) == reflection->GetInt32(second, field);
+    case google::protobuf::FieldDescriptor::CPPTYPE_INT64:
+        return reflection->GetInt64(first, field) == reflection->GetInt64(second, field);
+    case google::protobuf::FieldDescriptor::CPPTYPE_UINT32:
+        return reflection->GetUInt32(first, field) == reflection->GetUInt32(second, field);
+    case google::protobuf::FieldDescriptor::CPPTYPE_UINT64:
+        return reflection->GetUInt64(first, field) == reflection->GetUInt64(second, field);
+    case google::protobuf::FieldDescriptor::CPPTYPE_BOOL:
+        return reflection->GetBool(first, field) == reflection->GetBool(second, field);
+    case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE:
+        return reflection->GetDouble(first, field) == reflection->GetDouble(second, field);
+    case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT:
+        return reflection->GetFloat(first, field) == reflection->GetFloat(second, field);
+    case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
+        return reflection->GetEnumValue(first, field) == reflection->GetEnumValue(second, field);
+    case google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE:
+        return google::protobuf::util::MessageDifferencer::Equals(reflection->GetMessage(first, field), reflection->GetMessage(second, field));
+    }
+    return false;
+}
+
+// map keys are integral, boolean or string values
+std::string getMapKey(const google::protobuf::Message& entry, const google::protobuf::FieldDescriptor* field)
+{
+    const auto* reflection = entry.GetReflection();
+    switch (field->cpp_type())
+    {
+    case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
+        return reflection->GetString(entry, field);
+    case google::protobuf::FieldDescriptor::CPPTYPE_INT32:
+        return std::to_string(reflection->GetInt32(entry, field));
+    case google::protobuf::FieldDescriptor::CPPTYPE_INT64:
+        return std::to_string(reflection->GetInt64(entry, field));
+    case google::protobuf::FieldDescriptor::CPPTYPE_UINT32:
+        return std::to_string(reflection->GetUInt32(entry, field));
+    case google::protobuf::FieldDescriptor::CPPTYPE_UINT64:
+        return std::to_string(reflection->GetUInt64(entry, field));
+    case google::protobuf::FieldDescriptor::CPPTYPE_BOOL:
+        return reflection->GetBool(entry, field) ? "1" : "0";
+    default:
+        throw std::logic_error("unsupported type of map key " + field->full_name());
+    }
+}
+
+const char* getOperator(Op op)
+{
+    switch (op)
+    {
+    case Op::Eq:
+        return "=";
+    case Op::Ne:
+        return "<>";
+    case Op::Lt:
+        return "<";
+    case Op::Le:
+        return "<=";
+    case Op::Gt:
+        return ">";
+    case Op::Ge:
+        return ">=";
+    case Op::Like:
+        return " LIKE ";
+    }
+    throw std::logic_error("unknown comparison");
+}
+
+const char* getFunctionName(Aggregate function)
+{
+    switch (function)
+    {
+    case Aggregate::Count:
+        return "COUNT";
+    case Aggregate::Sum:
+        return "SUM";
+    case Aggregate::Min:
+        return "MIN";
+    case Aggregate::Max:
+        return "MAX";
+    case Aggregate::Avg:
+        return "AVG";
+    }
+    throw std::logic_error("unknown aggregate function");
+}
+
+}
+
+Database::Transaction::Transaction(Database& database) :
+    database(database),
+    name("ProtoDatabase_" + std::to_string(database.transactionDepth))
+{
+    // savepoint out of any transaction begins a new one and its release commits it
+    database.database.exec("SAVEPOINT " + name + ";");
+    ++database.transactionDepth;
+}
+
+Database::Transaction::~Transaction()
+{
+    if (finished)
+        return;
+
+    try
+    {
+        rollback();
+    }
+    catch (...)
+    {
+        --database.transactionDepth;
+    }
+}
+
+void Database::Transaction::commit()
+{
+    ScopedTimer timer(database.transactionDepth == 1 && database.statsEnabled ? &database.stats.commits : nullptr);
+    finish("RELEASE " + name + ";");
+}
+
+void Database::Transaction::rollback()
+{
+    // messages read inside the transaction may be cached
+    database.messageCache.clear();
+    finish("ROLLBACK TO " + name + "; RELEASE " + name + ";");
+}
+
+void Database::Transaction::finish(const std::string& command)
+{
+    if (finished)
+        throw std::logic_error("transaction " + name + " is already finished");
+
+    database.database.exec(command);
+    finished = true;
+    --database.transactionDepth;
+}
+
+Database::Database() : Database(":memory:", DatabaseOptions{})
 {}
 
-Database::Database(const std::string& path) : database(path, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE)
+Database::Database(const DatabaseOptions& options) : Database(":memory:", options)
 {}
 
+Database::Database(const std::string& path, const DatabaseOptions& options) :
+    database(path, options.readOnly ? SQLite::OPEN_READONLY : SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE, static_cast<int>(options.busyTimeout.count())),
+    statements(database, options.statementCacheCapacity),
+    messageCache(options.messageCacheCapacity)
+{
+    configure(options);
+    setStatsEnabled(options.collectStats);
+}
+
 int64_t Database::getTableCount() const
 {
     SQLite::Statement query(database, "SELECT COUNT(*) FROM sqlite_master WHERE type='table';");
@@ -44,7 +257,9 @@ void Database::createTable(const google::protobuf::Message& message)
 
 int64_t Database::insertMessage(const google::protobuf::Message& message)
 {
-    SQLite::Transaction transaction(database);
+    ScopedTimer timer(getHistogram(DatabaseStats::Operation::InsertMessage));
+    messageCache.invalidate(message.GetDescriptor());
+    Transaction transaction(*this);
 
     uint64_t id = writeMessageImpl(message, false);
     transaction.commit();
@@ -54,14 +269,17 @@ int64_t Database::insertMessage(const google::protobuf::Message& message)
 
 void Database::createTable(const google::protobuf::Descriptor* reflection)
 {
-    SQLite::Transaction transaction(database);
+    ScopedTimer timer(getHistogram(DatabaseStats::Operation::CreateTable));
+    Transaction transaction(*this);
     createTableImpl(reflection);
     transaction.commit();
 }
 
 int64_t Database::writeMessage(const google::protobuf::Message& message)
 {
-    SQLite::Transaction transaction(database);
+    ScopedTimer timer(getHistogram(DatabaseStats::Operation::WriteMessage));
+    messageCache.invalidate(message.GetDescriptor());
+    Transaction transaction(*this);
 
     uint64_t id = writeMessageImpl(message, true);
     transaction.commit();
@@ -69,72 +287,227 @@ int64_t Database::writeMessage(const google::protobuf::Message& message)
     return id;
 }
 
+std::vector<int64_t> Database::insertMessages(std::span<const google::protobuf::Message* const> messages)
+{
+    ScopedTimer timer(getHistogram(DatabaseStats::Operation::InsertMessages));
+    invalidateCachedMessages(messages);
+    Transaction transaction(*this);
+
+    auto ids = writeMessagesImpl(messages, false);
+    transaction.commit();
+
+    return ids;
+}
+
+std::vector<int64_t> Database::writeMessages(std::span<const google::protobuf::Message* const> messages)
+{
+    ScopedTimer timer(getHistogram(DatabaseStats::Operation::WriteMessages));
+    invalidateCachedMessages(messages);
+    Transaction transaction(*this);
+
+    auto ids = writeMessagesImpl(messages, true);
+    transaction.commit();
+
+    return ids;
+}
+
 void Database::deleteMessage(const google::protobuf::Message& message)
 {
-    SQLite::Transaction transaction(database);
+    ScopedTimer timer(getHistogram(DatabaseStats::Operation::DeleteMessage));
+    messageCache.invalidate(message.GetDescriptor());
+    Transaction transaction(*this);
     deleteMessageImpl(message);
     transaction.commit();
 }
 
 void Database::clearTable(const std::string& type)
 {
-    SQLite::Transaction transaction(database);
+    ScopedTimer timer(getHistogram(DatabaseStats::Operation::ClearTable));
+    messageCache.invalidate(type);
+    Transaction transaction(*this);
     clearTableImpl(type);
     transaction.commit();
 }
 
-void Database::createTableImpl(const google::protobuf::Descriptor* descriptor, bool uniqueObjects)
+void Database::setStatementCacheCapacity(size_t capacity)
 {
-    std::string fields;
-    std::string uniqueFields;
-    std::vector<std::pair<std::string, std::string>> foreignKeys;
-    std::vector<std::string> fieldList;
+    statements.setCapacity(capacity);
+}
 
-    for (int i = 0; i < descriptor->field_count(); ++i)
+StatementCache::Stats Database::getStatementCacheStats() const
+{
+    return statements.getStats();
+}
+
+Database::Transaction Database::beginBatch()
+{
+    return Transaction(*this);
+}
+
+void Database::setMessageCacheCapacity(size_t capacity)
+{
+    messageCache.setCapacity(capacity);
+}
+
+void Database::setStatsEnabled(bool enabled)
+{
+    if (enabled == statsEnabled)
+        return;
+
+    const int64_t changes = sqlite3_total_changes(database.getHandle());
+    if (enabled)
     {
-        const auto* field = descriptor->field(i);
-        auto fieldName = getColumnName(field->name());
+        changesBase = changes;
+        sqlite3_trace_v2(database.getHandle(), SQLITE_TRACE_STMT | SQLITE_TRACE_ROW, &traceStatement, &stats);
+    }
+    else
+    {
+        stats.rowsWritten += changes - changesBase;
+        sqlite3_trace_v2(database.getHandle(), 0, nullptr, nullptr);
+    }
+    statsEnabled = enabled;
+}
 
-        if (field->is_map())
-        {
-            createMapTable(descriptor, field);
-            continue;
-        }
+DatabaseStats Database::getStats() const
+{
+    DatabaseStats res = stats;
+    if (statsEnabled)
+        res.rowsWritten += sqlite3_total_changes(database.getHandle()) - changesBase;
+    res.statementCache = statements.getStats();
+    res.messageCache = messageCache.getStats();
+    return res;
+}
 
-        if (field->is_repeated())
+void Database::resetStats()
+{
+    stats = DatabaseStats{};
+    changesBase = sqlite3_total_changes(database.getHandle());
+    statements.resetStats();
+    messageCache.resetStats();
+}
+
+void Database::invalidateCachedMessages(std::span<const google::protobuf::Message* const> messages)
+{
+    const google::protobuf::Descriptor* descriptor = nullptr;
+    for (const auto* message : messages)
+    {
+        if (message->GetDescriptor() != descriptor)
         {
-            createArrayTable(descriptor, field);
-            continue;
+            descriptor = message->GetDescriptor();
+            messageCache.invalidate(descriptor);
         }
+    }
+}
+
+void Database::configure(const DatabaseOptions& options)
+{
+    // page size has to be set before the journal is switched to WAL
+    if (options.pageSize)
+        database.exec("PRAGMA page_size=" + std::to_string(options.pageSize.value()) + ";");
+
+    switch (options.journalMode)
+    {
+    case DatabaseOptions::JournalMode::Default:
+        break;
+    case DatabaseOptions::JournalMode::Delete:
+        database.exec("PRAGMA journal_mode=DELETE;");
+        break;
+    case DatabaseOptions::JournalMode::Truncate:
+        database.exec("PRAGMA journal_mode=TRUNCATE;");
+        break;
+    case DatabaseOptions::JournalMode::Persist:
+        database.exec("PRAGMA journal_mode=PERSIST;");
+        break;
+    case DatabaseOptions::JournalMode::Memory:
+        database.exec("PRAGMA journal_mode=MEMORY;");
+        break;
+    case DatabaseOptions::JournalMode::Wal:
+        database.exec("PRAGMA journal_mode=WAL;");
+        break;
+    case DatabaseOptions::JournalMode::Off:
+        database.exec("PRAGMA journal_mode=OFF;");
+        break;
+    }
+
+    switch (options.synchronous)
+    {
+    case DatabaseOptions::Synchronous::Default:
+        break;
+    case DatabaseOptions::Synchronous::Off:
+        database.exec("PRAGMA synchronous=OFF;");
+        break;
+    case DatabaseOptions::Synchronous::Normal:
+        database.exec("PRAGMA synchronous=NORMAL;");
+        break;
+    case DatabaseOptions::Synchronous::Full:
+        database.exec("PRAGMA synchronous=FULL;");
+        break;
+    case DatabaseOptions::Synchronous::Extra:
+        database.exec("PRAGMA synchronous=EXTRA;");
+        break;
+    }
+
+    switch (options.tempStore)
+    {
+    case DatabaseOptions::TempStore::Default:
+        break;
+    case DatabaseOptions::TempStore::File:
+        database.exec("PRAGMA temp_store=FILE;");
+        break;
+    case DatabaseOptions::TempStore::Memory:
+        database.exec("PRAGMA temp_store=MEMORY;");
+        break;
+    }
+
+    if (options.cacheSize)
+        database.exec("PRAGMA cache_size=" + std::to_string(options.cacheSize.value()) + ";");
+    if (options.mmapSize)
+        database.exec("PRAGMA mmap_size=" + std::to_string(options.mmapSize.value()) + ";");
+}
+
+void Database::createTableImpl(const google::protobuf::Descriptor* descriptor, bool uniqueObjects)
+{
+    const auto& plan = getPlan(descriptor);
+    messageCache.registerType(descriptor);
+
+    std::string fields;
+    std::string uniqueFields;
+    std::vector<std::pair<std::string, std::string>> foreignKeys;
 
-        bool isKey = false;
-        if (field->options().HasExtension(Proto::objectKeyField) && field->options().GetExtension(Proto::objectKeyField))
+    for (const auto& table : plan.children)
+    {
+        if (table.isMap)
+            createMapTable(plan, table);
+        else
+            createArrayTable(plan, table);
+    }
+
+    for (const auto& column : plan.columns)
+    {
+        if (column.isKey)
         {
-            uniqueFields += ",UNIQUE(" + fieldName + ')';
-            isKey = true;
+            uniqueFields += ",UNIQUE(" + column.name + ')';
             uniqueObjects = true;
         }
 
-        if (field->cpp_type() == google::protobuf::FieldDescriptor::CppType::CPPTYPE_MESSAGE)
+        if (column.field && column.field->cpp_type() == google::protobuf::FieldDescriptor::CppType::CPPTYPE_MESSAGE)
         {
-            auto nestedMessage = field->message_type();
-            createTableImpl(nestedMessage, isKey);
-            foreignKeys.emplace_back(fieldName, nestedMessage->name());
+            auto nestedMessage = column.field->message_type();
+            createTableImpl(nestedMessage, column.isKey);
+            foreignKeys.emplace_back(column.name, nestedMessage->name());
         }
 
-        fields += ',' + fieldName + " " + getFieldType(field);
-        fieldList.emplace_back(fieldName);
+        fields += ',' + column.name + " " + column.type;
     }
 
     if (uniqueFields.empty() && uniqueObjects)
     {
         uniqueFields += ",UNIQUE(";
-        for (int i = 0; i < fieldList.size(); ++i)
+        for (size_t i = 0; i < plan.columns.size(); ++i)
         {
-            auto fieldName = fieldList[i];
             if (i > 0)
                 uniqueFields += ',';
-            uniqueFields += fieldName;
+            uniqueFields += plan.columns[i].name;
         }
         uniqueFields += ')';
     }
@@ -145,14 +518,17 @@ void Database::createTableImpl(const google::protobuf::Descriptor* descriptor, b
             fields += ",FOREIGN KEY(" + foreignKey.first + ") REFERENCES " + foreignKey.second + "(id)";
     }
 
-    std::string fullSQL = "CREATE TABLE IF NOT EXISTS " + descriptor->name() + " (id INTEGER PRIMARY KEY" + fields + uniqueFields + ");";
+    std::string fullSQL = "CREATE TABLE IF NOT EXISTS " + plan.tableName + " (id INTEGER PRIMARY KEY" + fields + uniqueFields + ");";
 
     database.exec(fullSQL);
 
+    for (const auto& index : plan.indexSql)
+        database.exec(index);
+
     for (const auto& key : foreignKeys)
     {
         SQLite::Statement trigger(database,
-                                  "CREATE TRIGGER IF NOT EXISTS on_delete_" + descriptor->name() + "_" + key.second + " AFTER DELETE ON " + descriptor->name() + " BEGIN"
+                                  "CREATE TRIGGER IF NOT EXISTS on_delete_" + plan.tableName + "_" + key.second + " AFTER DELETE ON " + plan.tableName + " BEGIN"
                                   "  DELETE FROM " + key.second + " WHERE id = old." + key.first + ";"
                                   "END;");
         trigger.exec();
@@ -161,304 +537,1164 @@ void Database::createTableImpl(const google::protobuf::Descriptor* descriptor, b
 
 int64_t Database::writeMessageImpl(const google::protobuf::Message& message, bool handleConficts) const
 {
-    std::string fieldNames;
-    std::string fieldValues;
-    std::string excludedValues;
-    std::vector<const google::protobuf::FieldDescriptor*> repeatedFields;
-    std::vector<const google::protobuf::FieldDescriptor*> dataFields;
-    std::vector<const google::protobuf::FieldDescriptor*> mapFields;
-    for (int i = 0; i < message.GetDescriptor()->field_count(); ++i)
+    const auto& plan = getPlan(message.GetDescriptor());
+
+    auto operation = handleConficts ? StatementCache::Operation::Upsert : StatementCache::Operation::Insert;
+    auto query = statements.acquire({ plan.descriptor, operation }, [&plan, handleConficts]() {
+        return handleConficts ? plan.upsertSql : plan.insertSql;
+    });
+    insertMessageFields(*query, message, plan.columns, true, 0, handleConficts);
+
+    int64_t id = 0;
+    if (handleConficts)
+    {
+        // updated row doesn't change last insert rowid, so ID of the row is returned by the statement
+        if (!query->executeStep())
+            throw std::runtime_error("couldn't write message to the database");
+        id = query->getColumn(0).getInt64();
+    }
+    else
     {
-        const auto* field = message.GetDescriptor()->field(i);
+        if (query->exec() == 0)
+            throw std::runtime_error("couldn't write message to the database");
+        id = database.getLastInsertRowid();
+    }
 
-        if (field->is_map())
+    writeChildren(plan, message, id, handleConficts);
+
+    return id;
+}
+
+std::vector<int64_t> Database::writeMessagesImpl(std::span<const google::protobuf::Message* const> messages, bool handleConficts) const
+{
+    std::vector<int64_t> ids;
+    ids.reserve(messages.size());
+
+    size_t begin = 0;
+    while (begin < messages.size())
+    {
+        const auto& plan = getPlan(messages[begin]->GetDescriptor());
+
+        size_t end = begin + 1;
+        while (end < messages.size() && messages[end]->GetDescriptor() == plan.descriptor)
+            ++end;
+
+        if (handleConficts || plan.columns.empty())
         {
-            mapFields.emplace_back(field);
-            continue;
+            for (size_t i = begin; i < end; ++i)
+                ids.emplace_back(writeMessageImpl(*messages[i], handleConficts));
         }
-
-        if (field->is_repeated())
+        else
         {
-            repeatedFields.emplace_back(field);
-            continue;
+            insertRows(plan, messages.subspan(begin, end - begin), ids);
         }
 
-        dataFields.emplace_back(field);
+        begin = end;
+    }
 
-        if (!fieldNames.empty())
+    return ids;
+}
+
+void Database::insertRows(const TablePlan& plan, std::span<const google::protobuf::Message* const> messages, std::vector<int64_t>& ids) const
+{
+    const size_t variableLimit = sqlite3_limit(database.getHandle(), SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+    const size_t maxRows = std::max<size_t>(1, variableLimit / plan.columns.size());
+
+    for (size_t offset = 0; offset < messages.size();)
+    {
+        const size_t rows = getChunkRows(messages.size() - offset, maxRows);
+
+        auto query = statements.acquire({ plan.descriptor, StatementCache::Operation::InsertRows, static_cast<int64_t>(rows) }, [&plan, rows]() {
+            return plan.getInsertSql(rows);
+        });
+        for (size_t row = 0; row < rows; ++row)
+            insertMessageFields(*query, *messages[offset + row], plan.columns, true, row * plan.columns.size());
+
+        std::vector<int64_t> inserted;
+        inserted.reserve(rows);
+        while (query->executeStep())
+            inserted.emplace_back(query->getColumn(0).getInt64());
+        if (inserted.size() != rows)
+            throw std::runtime_error("couldn't write messages to the database");
+
+        // order of RETURNING rows isn't specified, new IDs grow in order of VALUES list
+        std::sort(inserted.begin(), inserted.end());
+        for (size_t row = 0; row < rows; ++row)
         {
-            fieldNames += ", ";
-            fieldValues += ", ";
-            excludedValues += ", ";
+            ids.emplace_back(inserted[row]);
+            writeChildren(plan, *messages[offset + row], ids.back(), false);
         }
 
-        auto fieldName = getColumnName(field->name());
-        fieldNames += fieldName;
-        fieldValues += "?";
-        excludedValues += fieldName + "=excluded." + fieldName;
+        offset += rows;
     }
+}
 
-    std::string fullSQL = "INSERT INTO " + message.GetDescriptor()->name();
-    if (!fieldNames.empty())
-    {
-        fullSQL += " (" + fieldNames + ") VALUES (" + fieldValues + ")";
-        if (handleConficts)
-            fullSQL += " ON CONFLICT DO UPDATE SET " + excludedValues;
-    }
-    else
+void Database::writeChildren(const TablePlan& plan, const google::protobuf::Message& message, int64_t id, bool isUpdate) const
+{
+    // rows of an updated message are compared with stored ones, so unchanged elements aren't rewritten
+    for (const auto& table : plan.children)
     {
-        fullSQL += " DEFAULT VALUES";
+        if (table.isMap)
+        {
+            if (isUpdate)
+                updateMap(message, table, id);
+            else
+                writeMap(message, table, id);
+        }
+        else
+        {
+            if (isUpdate)
+                updateArray(message, table, id);
+            else
+                writeArray(message, table, id);
+        }
     }
-
-    fullSQL += ';';
-
-    SQLite::Statement query(database, fullSQL);
-    insertMessageFields(query, message, dataFields, true);
-
-    if (query.exec() == 0)
-        throw std::runtime_error("couldn't write message to the database");
-
-    auto id = database.getLastInsertRowid();
-
-    for (const auto* field : mapFields)
-        writeMap(message, field, id);
-
-    for (const auto* field : repeatedFields)
-        writeArray(message, field, id);
-
-    return id;
 }
 
 void Database::deleteMessageImpl(const google::protobuf::Message& message)
 {
-    auto keys = getMessageKeys(message);
+    const auto& keys = getMessageKeys(message);
 
     if (keys.empty())
         throw std::logic_error("no keys for deletion of " + message.GetDescriptor()->name());
 
-    std::string fullSQL = "DELETE FROM " + message.GetDescriptor()->name() + " WHERE ";
-    for (size_t i = 0; i < keys.size(); ++i)
-    {
-        fullSQL += keys[i]->name() + "=?";
-        if (i < keys.size() - 1)
-            fullSQL = " AND ";
-    }
-    fullSQL += ';';
-
-    SQLite::Statement query(database, fullSQL);
-    insertMessageFields(query, message, keys, false);
+    auto query = statements.acquire({ message.GetDescriptor(), StatementCache::Operation::Delete }, [this, &message]() {
+        return getPlan(message.GetDescriptor()).deleteSql;
+    });
+    insertMessageFields(*query, message, keys, false);
 
-    database.exec(fullSQL);
+    query->exec();
 }
 
-void Database::createMapTable(const google::protobuf::Descriptor* descriptor, const google::protobuf::FieldDescriptor* field)
+void Database::createMapTable(const TablePlan& plan, const TablePlan::ChildTable& table)
 {
-    if (!field->message_type() || !field->message_type()->map_key())
-        throw std::logic_error("not message type in map table creation");
-
-    auto keyField = field->message_type()->map_key();
-    std::string keyFieldName = getColumnName(keyField->name());
-    auto valueField = field->message_type()->map_value();
-    std::string valueFieldName = getColumnName(valueField->name());
-    std::string fullSQL = "CREATE TABLE IF NOT EXISTS " + getFieldTableName(descriptor, field) + " (id INTEGER PRIMARY KEY, " +
-                                keyFieldName + " " + getFieldType(keyField) + ", " +
-                                valueFieldName + " " + getFieldType(valueField) + ", "
+    const auto& keyColumn = table.columns[0];
+    const auto& valueColumn = table.columns[1];
+    std::string fullSQL = "CREATE TABLE IF NOT EXISTS " + table.name + " (id INTEGER PRIMARY KEY, " +
+                                keyColumn.name + " " + keyColumn.type + ", " +
+                                valueColumn.name + " " + valueColumn.type + ", "
                                 "owner_id INTEGER, "
-                                "UNIQUE(owner_id, " + keyFieldName + "),"
-                                "FOREIGN KEY(owner_id) REFERENCES " + descriptor->name() + "(id)";
+                                "UNIQUE(owner_id, " + keyColumn.name + "),"
+                                "FOREIGN KEY(owner_id) REFERENCES " + plan.tableName + "(id)";
 
-    if (valueField->cpp_type() == google::protobuf::FieldDescriptor::CppType::CPPTYPE_MESSAGE)
+    if (valueColumn.field->cpp_type() == google::protobuf::FieldDescriptor::CppType::CPPTYPE_MESSAGE)
     {
-        auto typeDesc = valueField->message_type();
+        auto typeDesc = valueColumn.field->message_type();
         createTableImpl(typeDesc);
-        fullSQL += ", FOREIGN KEY(" + valueFieldName + ") REFERENCES " + typeDesc->name() + "(id)";
+        fullSQL += ", FOREIGN KEY(" + valueColumn.name + ") REFERENCES " + typeDesc->name() + "(id)";
     }
     fullSQL += ");";
 
     database.exec(fullSQL);
 }
 
-void Database::createArrayTable(const google::protobuf::Descriptor* descriptor, const google::protobuf::FieldDescriptor* field)
+void Database::createArrayTable(const TablePlan& plan, const TablePlan::ChildTable& table)
 {
-    std::string fieldName = getColumnName(field->name());
-    std::string fullSQL = "CREATE TABLE IF NOT EXISTS " + getFieldTableName(descriptor, field) + " ("
-                                "id INTEGER PRIMARY KEY," + fieldName + " " + getFieldType(field) + ", owner_id INTEGER,"
-                                "UNIQUE(owner_id," + fieldName + "),"
-                                "FOREIGN KEY(owner_id) REFERENCES " + descriptor->name() + "(id)";
+    const auto& column = table.columns[0];
+    std::string fullSQL = "CREATE TABLE IF NOT EXISTS " + table.name + " ("
+                                "id INTEGER PRIMARY KEY," + column.name + " " + column.type + ", owner_id INTEGER,"
+                                "FOREIGN KEY(owner_id) REFERENCES " + plan.tableName + "(id)";
 
-    if (field->cpp_type() == google::protobuf::FieldDescriptor::CppType::CPPTYPE_MESSAGE)
+    if (table.field->cpp_type() == google::protobuf::FieldDescriptor::CppType::CPPTYPE_MESSAGE)
     {
-        createTableImpl(field->message_type());
-        fullSQL += ", FOREIGN KEY(" + fieldName + ") REFERENCES " + field->message_type()->name() + "(id)";
+        createTableImpl(table.field->message_type());
+        fullSQL += ", FOREIGN KEY(" + column.name + ") REFERENCES " + table.field->message_type()->name() + "(id)";
     }
     fullSQL += ");";
 
     database.exec(fullSQL);
-}
 
-bool Database::isKey(const google::protobuf::FieldDescriptor* field)
-{
-    return field->options().HasExtension(Proto::objectKeyField) && field->options().GetExtension(Proto::objectKeyField);
+    // values may repeat, elements are ordered by id within the owner
+    database.exec("CREATE INDEX IF NOT EXISTS " + table.name + "_owner ON " + table.name + " (owner_id, id);");
 }
 
-SQLite::Statement Database::getAllObjects(const std::string& type) const
+const TablePlan& Database::getPlan(const google::protobuf::Descriptor* descriptor) const
 {
-    return SQLite::Statement{ database, "SELECT * FROM " + type + ';' };
+    auto it = plans.find(descriptor);
+    if (it == plans.end())
+        it = plans.emplace(descriptor, compilePlan(descriptor)).first;
+    return *it->second;
 }
 
-std::optional<int64_t> Database::findMessage(const google::protobuf::Message& message) const
+const Projection& Database::getProjection(const google::protobuf::Descriptor* descriptor, std::span<const google::protobuf::FieldDescriptor* const> fields) const
 {
-    auto keys = getMessageKeys(message);
+    std::vector<int> indices;
+    indices.reserve(fields.size());
+    for (const auto* field : fields)
+    {
+        if (field->containing_type() != descriptor)
+            throw std::logic_error("field " + field->name() + " doesn't belong to " + descriptor->name());
+        indices.emplace_back(field->index());
+    }
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+    auto it = projections.find({ descriptor, indices });
+    if (it != projections.end())
+        return *it->second;
+
+    const auto& plan = getPlan(descriptor);
+
+    auto projection = std::make_unique<Projection>();
+    projection->plan = &plan;
+
+    std::string columns = "id";
+    auto addColumn = [&projection, &columns](TablePlan::Column column) {
+        column.index = static_cast<int>(projection->columns.size()) + 1;
+        columns += ", " + column.name;
+        projection->columns.emplace_back(std::move(column));
+    };
+
+    // serialized message is read completely and trimmed after parsing
+    if (plan.isBlob)
+        addColumn(plan.columns.back());
 
-    std::string queryStr = "SELECT id FROM " + message.GetDescriptor()->name();
-    if (!keys.empty())
+    for (int index : indices)
     {
-        std::string condition;
-        for (size_t i = 0; i < keys.size(); ++i)
+        const auto* field = descriptor->field(index);
+        projection->fields.emplace_back(field);
+
+        if (plan.isBlob)
+            continue;
+
+        if (const auto* column = plan.findColumn(field))
+        {
+            addColumn(*column);
+            continue;
+        }
+
+        for (const auto& table : plan.children)
         {
-            condition += getColumnName(keys[i]->name()) + "=?";
-            if (i < keys.size() - 1)
-                condition += " AND ";
+            if (table.field == field)
+                projection->children.emplace_back(&table);
         }
-        queryStr += " WHERE " + std::move(condition);
     }
-    queryStr += " ORDER BY id;";
 
-    SQLite::Statement query(database, queryStr);
-    insertMessageFields(query, message, keys, false);
+    projection->selectSql = "SELECT " + columns + " FROM " + plan.tableName;
+    projection->selectAllSql = projection->selectSql + " ORDER BY id;";
 
-    if (!query.executeStep())
+    return *projections.emplace(std::make_pair(descriptor, std::move(indices)), std::move(projection)).first->second;
+}
+
+std::vector<const google::protobuf::FieldDescriptor*> Database::getMaskFields(const google::protobuf::Descriptor* descriptor, const google::protobuf::FieldMask& mask)
+{
+    std::vector<const google::protobuf::FieldDescriptor*> res;
+    for (const auto& path : mask.paths())
+    {
+        const auto name = path.substr(0, path.find('.'));
+        const auto* field = descriptor->FindFieldByName(name);
+        if (!field)
+            throw std::logic_error("unknown field '" + name + "' in mask for " + descriptor->name());
+        res.emplace_back(field);
+    }
+    return res;
+}
+
+std::unique_ptr<TablePlan> Database::compilePlan(const google::protobuf::Descriptor* descriptor) const
+{
+    auto plan = std::make_unique<TablePlan>();
+    plan->descriptor = descriptor;
+    plan->tableName = descriptor->name();
+    plan->isBlob = descriptor->options().HasExtension(Proto::storageMode) && descriptor->options().GetExtension(Proto::storageMode) == Proto::BLOB;
+    plan->fieldColumns.assign(descriptor->field_count(), -1);
+
+    std::vector<std::vector<const google::protobuf::FieldDescriptor*>> indexes;
+    for (int i = 0; i < descriptor->field_count(); ++i)
+    {
+        if (isIndexed(descriptor->field(i)))
+            indexes.push_back({ descriptor->field(i) });
+    }
+    for (int i = 0; i < descriptor->options().ExtensionSize(Proto::index); ++i)
+    {
+        const auto& names = descriptor->options().GetExtension(Proto::index, i);
+
+        std::vector<const google::protobuf::FieldDescriptor*> fields;
+        size_t begin = 0;
+        while (begin <= names.size())
+        {
+            size_t end = std::min(names.find(',', begin), names.size());
+            auto first = names.find_first_not_of(' ', begin);
+            auto last = names.find_last_not_of(' ', end - 1);
+            auto name = first < end && last != std::string::npos ? names.substr(first, last - first + 1) : std::string{};
+
+            const auto* field = descriptor->FindFieldByName(name);
+            if (!field)
+                throw std::logic_error("unknown field '" + name + "' in index of " + descriptor->name());
+            fields.emplace_back(field);
+
+            begin = end + 1;
+        }
+        indexes.emplace_back(std::move(fields));
+    }
+
+    std::unordered_set<const google::protobuf::FieldDescriptor*> indexedFields;
+    for (const auto& index : indexes)
+    {
+        for (const auto* field : index)
+        {
+            if (field->is_repeated())
+                throw std::logic_error("repeated field " + field->name() + " can't be indexed in " + descriptor->name());
+            indexedFields.emplace(field);
+        }
+    }
+
+    for (int i = 0; i < descriptor->field_count(); ++i)
+    {
+        const auto* field = descriptor->field(i);
+
+        // serialized messages keep only keys and indexed fields in separate columns
+        if (plan->isBlob && (field->is_repeated() || (!isKey(field) && indexedFields.count(field) == 0)))
+            continue;
+
+        if (field->is_map())
+        {
+            if (!field->message_type() || !field->message_type()->map_key())
+                throw std::logic_error("not message type in map table creation");
+
+            TablePlan::ChildTable table;
+            table.field = field;
+            table.name = getFieldTableName(descriptor, field);
+            table.isMap = true;
+            table.columns.emplace_back(compileColumn(field->message_type()->map_key(), 1));
+            table.columns.emplace_back(compileColumn(field->message_type()->map_value(), 2));
+            table.insertSql = "INSERT INTO " + table.name + "(" + table.columns[0].name + ", " + table.columns[1].name + ", owner_id) VALUES (?,?,?);";
+            table.deleteSql = "DELETE FROM " + table.name + " WHERE owner_id=?;";
+            table.updateSql = "UPDATE " + table.name + " SET " + table.columns[1].name + "=? WHERE id=?;";
+            table.deleteElementSql = "DELETE FROM " + table.name + " WHERE id=?;";
+            table.selectRowsSql = "SELECT id, " + table.columns[1].name + " FROM " + table.name + " WHERE owner_id=? ORDER BY id;";
+
+            const auto& keyColumn = table.columns[0];
+            const auto& valueColumn = table.columns[1];
+            if (valueColumn.field->cpp_type() == google::protobuf::FieldDescriptor::CppType::CPPTYPE_MESSAGE)
+            {
+                table.selectSql = "SELECT entry.id, entry." + keyColumn.name + ", value.* FROM " + table.name + " entry "
+                                  "JOIN " + valueColumn.field->message_type()->name() + " value ON value.id=entry." + valueColumn.name + " "
+                                  "WHERE entry.owner_id=? ORDER BY entry.id;";
+                table.selectOwnersSql = "SELECT entry.owner_id, entry.id, entry." + keyColumn.name + ", value.* FROM " + table.name + " entry "
+                                        "JOIN " + valueColumn.field->message_type()->name() + " value ON value.id=entry." + valueColumn.name + " "
+                                        "WHERE entry.owner_id IN (";
+                table.selectOwnersOrderSql = ") ORDER BY entry.id;";
+            }
+            else
+            {
+                table.selectSql = "SELECT id, " + keyColumn.name + ", " + valueColumn.name + " FROM " + table.name + " WHERE owner_id=? ORDER BY id;";
+                table.selectOwnersSql = "SELECT owner_id, id, " + keyColumn.name + ", " + valueColumn.name + " FROM " + table.name + " WHERE owner_id IN (";
+                table.selectOwnersOrderSql = ") ORDER BY id;";
+            }
+
+            plan->children.emplace_back(std::move(table));
+            continue;
+        }
+
+        if (field->is_repeated())
+        {
+            TablePlan::ChildTable table;
+            table.field = field;
+            table.name = getFieldTableName(descriptor, field);
+
+            TablePlan::Column column;
+            column.field = field;
+            column.name = getColumnName(field->name());
+            column.type = getFieldType(field);
+            column.index = 1;
+
+            table.bindElement = TablePlan::getBindElementFunction(field);
+            table.addElement = TablePlan::getAddFunction(field);
+            table.insertRowsSql = "INSERT INTO " + table.name + "(" + column.name + ",owner_id) VALUES ";
+            table.rowValuesSql = "(?,?)";
+            table.deleteSql = "DELETE FROM " + table.name + " WHERE owner_id=?;";
+            table.updateSql = "UPDATE " + table.name + " SET " + column.name + "=? WHERE id=?;";
+            table.deleteTailSql = "DELETE FROM " + table.name + " WHERE owner_id=? AND id>=?;";
+            table.selectRowsSql = "SELECT id, " + column.name + " FROM " + table.name + " WHERE owner_id=? ORDER BY id;";
+
+            if (field->cpp_type() == google::protobuf::FieldDescriptor::CppType::CPPTYPE_MESSAGE)
+            {
+                table.selectSql = "SELECT element.* FROM " + table.name + " owner "
+                                  "JOIN " + field->message_type()->name() + " element ON element.id=owner." + column.name + " "
+                                  "WHERE owner.owner_id=? ORDER BY owner.id;";
+                table.selectOwnersSql = "SELECT owner.owner_id, element.* FROM " + table.name + " owner "
+                                        "JOIN " + field->message_type()->name() + " element ON element.id=owner." + column.name + " "
+                                        "WHERE owner.owner_id IN (";
+                table.selectOwnersOrderSql = ") ORDER BY owner.id;";
+            }
+            else
+            {
+                table.selectSql = "SELECT id, " + column.name + " FROM " + table.name + " WHERE owner_id=? ORDER BY id;";
+                table.selectOwnersSql = "SELECT owner_id, id, " + column.name + " FROM " + table.name + " WHERE owner_id IN (";
+                table.selectOwnersOrderSql = ") ORDER BY id;";
+            }
+
+            table.columns.emplace_back(std::move(column));
+            plan->children.emplace_back(std::move(table));
+            continue;
+        }
+
+        auto column = compileColumn(field, static_cast<int>(plan->columns.size()) + 1);
+        column.isIndexed = std::any_of(indexes.begin(), indexes.end(), [field](const auto& index) { return index.front() == field; });
+
+        if (column.isKey)
+            plan->keyColumns.emplace_back(column);
+
+        plan->fieldColumns[i] = static_cast<int>(plan->columns.size());
+        plan->columns.emplace_back(std::move(column));
+    }
+
+    if (plan->isBlob)
+    {
+        TablePlan::Column column;
+        column.name = "message_data";
+        column.type = "BLOB";
+        column.index = static_cast<int>(plan->columns.size()) + 1;
+        column.bind = TablePlan::getSerializedBindFunction();
+        column.read = TablePlan::getSerializedReadFunction();
+        plan->columns.emplace_back(std::move(column));
+    }
+
+    std::string fieldNames;
+    std::string fieldValues;
+    std::string excludedValues;
+    for (const auto& column : plan->columns)
+    {
+        if (!fieldNames.empty())
+        {
+            fieldNames += ", ";
+            fieldValues += ", ";
+            excludedValues += ", ";
+        }
+        fieldNames += column.name;
+        fieldValues += "?";
+        excludedValues += column.name + "=excluded." + column.name;
+    }
+
+    plan->insertSql = "INSERT INTO " + plan->tableName;
+    if (!fieldNames.empty())
+    {
+        plan->insertRowsSql = plan->insertSql + " (" + fieldNames + ") VALUES ";
+        plan->rowValuesSql = "(" + fieldValues + ")";
+        plan->insertSql = plan->insertRowsSql + plan->rowValuesSql;
+    }
+    else
+    {
+        plan->insertSql += " DEFAULT VALUES";
+    }
+    plan->upsertSql = plan->insertSql;
+    if (!fieldNames.empty())
+    {
+        plan->upsertSql += " ON CONFLICT DO UPDATE SET " + excludedValues;
+
+        std::string values;
+        for (const auto& column : plan->columns)
+            values += (values.empty() ? "" : ", ") + column.name + "=?";
+        plan->updateSql = "UPDATE " + plan->tableName + " SET " + values + " WHERE id=?;";
+    }
+    plan->insertSql += ';';
+    plan->upsertSql += " RETURNING id;";
+
+    plan->selectAllSql = "SELECT * FROM " + plan->tableName + ';';
+    plan->selectByIdSql = "SELECT * FROM " + plan->tableName + " WHERE id=?;";
+
+    std::string condition;
+    for (const auto& column : plan->getLookupColumns())
+    {
+        if (!condition.empty())
+            condition += " AND ";
+        condition += column.name + "=?";
+    }
+    plan->selectIdSql = "SELECT id FROM " + plan->tableName;
+    if (!condition.empty())
+        plan->selectIdSql += " WHERE " + condition;
+    plan->selectIdSql += " ORDER BY id;";
+    plan->deleteSql = "DELETE FROM " + plan->tableName + " WHERE " + condition + ';';
+
+    for (const auto& index : indexes)
+    {
+        std::string name = "index_" + plan->tableName;
+        std::string columns;
+        for (const auto* field : index)
+        {
+            const auto& column = plan->columns[plan->fieldColumns[field->index()]];
+            name += "_" + field->name();
+            if (!columns.empty())
+                columns += ", ";
+            columns += column.name;
+        }
+        plan->indexSql.emplace_back("CREATE INDEX IF NOT EXISTS " + name + " ON " + plan->tableName + " (" + columns + ");");
+    }
+
+    return plan;
+}
+
+TablePlan::Column Database::compileColumn(const google::protobuf::FieldDescriptor* field, int index) const
+{
+    TablePlan::Column column;
+    column.field = field;
+    column.name = getColumnName(field->name());
+    column.type = getFieldType(field);
+    column.index = index;
+    column.isKey = isKey(field);
+    column.bind = TablePlan::getBindFunction(field);
+    column.read = TablePlan::getReadFunction(field);
+    return column;
+}
+
+bool Database::isKey(const google::protobuf::FieldDescriptor* field)
+{
+    return field->options().HasExtension(Proto::objectKeyField) && field->options().GetExtension(Proto::objectKeyField);
+}
+
+bool Database::isIndexed(const google::protobuf::FieldDescriptor* field)
+{
+    return field->options().HasExtension(Proto::indexedField) && field->options().GetExtension(Proto::indexedField);
+}
+
+void Database::checkLookupField(const google::protobuf::Descriptor* descriptor, const google::protobuf::FieldDescriptor* field) const
+{
+    const auto* column = getPlan(descriptor).findColumn(field);
+    if (!column || (!column->isKey && !column->isIndexed))
+        throw std::logic_error("field " + field->name() + " is neither a key nor indexed for " + descriptor->name());
+}
+
+StatementCache::Handle Database::getAllObjects(const google::protobuf::Descriptor* descriptor) const
+{
+    return statements.acquire({ descriptor, StatementCache::Operation::SelectAll }, [this, descriptor]() {
+        return getPlan(descriptor).selectAllSql;
+    });
+}
+
+std::optional<int64_t> Database::findMessage(const google::protobuf::Message& message) const
+{
+    const auto& keys = getMessageKeys(message);
+
+    auto query = statements.acquire({ message.GetDescriptor(), StatementCache::Operation::SelectId }, [this, &message]() {
+        return getPlan(message.GetDescriptor()).selectIdSql;
+    });
+    insertMessageFields(*query, message, keys, false);
+
+    if (!query->executeStep())
         return std::optional<int64_t>{};
 
-    return query.getColumn(0).getInt64();
+    return query->getColumn(0).getInt64();
 }
 
 void Database::findMessage(const std::string& type, int64_t id, google::protobuf::Message* message) const
 {
-    SQLite::Statement query{ database, "SELECT * FROM " + type + " WHERE id=" + std::to_string(id) + ';' };
-    if (!query.executeStep())
+    auto query = statements.acquire({ message->GetDescriptor(), StatementCache::Operation::SelectById }, [this, message]() {
+        return getPlan(message->GetDescriptor()).selectByIdSql;
+    });
+    query->bind(1, id);
+    if (!query->executeStep())
         throw std::logic_error("couldn't find object with type " + type + " and ID " + std::to_string(id));
 
-    readFields(query, message);
+    readFields(*query, message);
 }
 
-std::vector<int64_t> Database::findAssociatedMessages(const std::string& type, int64_t owner) const
+void Database::readFields(SQLite::Statement& query, google::protobuf::Message* message, int offset, ReadMode mode) const
 {
-    SQLite::Statement query{ database, "SELECT id FROM " + type + " WHERE owner_id=" + std::to_string(owner) + " ORDER BY id;" };
-    std::vector<int64_t> res;
-    while(query.executeStep())
-        res.emplace_back(query.getColumn(0).getInt64());
+    const auto& plan = getPlan(message->GetDescriptor());
+
+    if (plan.isBlob)
+    {
+        const auto& data = plan.columns.back();
+        data.read(query.getColumn(data.index + offset), message, data.field);
+        return;
+    }
+
+    if (mode == ReadMode::Lazy)
+    {
+        for (const auto& column : plan.columns)
+        {
+            if (column.read)
+                column.read(query.getColumn(column.index + offset), message, column.field);
+        }
+        return;
+    }
+
+    readColumns(query, message, plan.columns, offset);
+
+    int64_t id = query.getColumn(offset).getInt64();
+    for (const auto& table : plan.children)
+    {
+        if (table.isMap)
+            readMap(message, table, id);
+        else
+            readArray(message, table, id);
+    }
+}
+
+void Database::loadField(google::protobuf::Message* message, const google::protobuf::FieldDescriptor* field) const
+{
+    const auto& plan = getPlan(message->GetDescriptor());
+    if (plan.keyColumns.empty())
+        throw std::logic_error("no keys to find the row of " + message->GetTypeName() + ", ID of the row is required");
+
+    auto id = findMessage(*message);
+    if (!id)
+        throw std::runtime_error("couldn't find row of " + message->GetTypeName() + " to load " + field->name());
+
+    loadField(message, field, id.value());
+}
+
+void Database::loadField(google::protobuf::Message* message, const google::protobuf::FieldDescriptor* field, int64_t id) const
+{
+    const auto& plan = getPlan(message->GetDescriptor());
+    if (field->containing_type() != plan.descriptor)
+        throw std::logic_error("field " + field->name() + " doesn't belong to " + message->GetTypeName());
+
+    // serialized messages are always read completely
+    if (plan.isBlob)
+        return;
+
+    for (const auto& table : plan.children)
+    {
+        if (table.field != field)
+            continue;
+
+        message->GetReflection()->ClearField(message, field);
+        if (table.isMap)
+            readMap(message, table, id);
+        else
+            readArray(message, table, id);
+        return;
+    }
+
+    const auto* column = plan.findColumn(field);
+    if (!column || column->read)
+        return;
+
+    auto query = statements.acquire({ plan.descriptor, StatementCache::Operation::SelectById }, [&plan]() {
+        return plan.selectByIdSql;
+    });
+    query->bind(1, id);
+    if (!query->executeStep())
+        throw std::logic_error("couldn't find object with type " + plan.tableName + " and ID " + std::to_string(id));
+
+    const int64_t nestedId = query->getColumn(column->index).getInt64();
+    query->reset();
+
+    auto nestedMessage = message->GetReflection()->MutableMessage(message, field);
+    nestedMessage->Clear();
+    findMessage(nestedMessage->GetDescriptor()->name(), nestedId, nestedMessage);
+}
+
+void Database::readProjection(SQLite::Statement& query, google::protobuf::Message* message, const Projection& projection) const
+{
+    readColumns(query, message, projection.columns);
+
+    if (projection.plan->isBlob)
+    {
+        std::vector<const google::protobuf::FieldDescriptor*> fields;
+        message->GetReflection()->ListFields(*message, &fields);
+        for (const auto* field : fields)
+        {
+            if (std::find(projection.fields.begin(), projection.fields.end(), field) == projection.fields.end())
+                message->GetReflection()->ClearField(message, field);
+        }
+        return;
+    }
+
+    int64_t id = query.getColumn(0).getInt64();
+    for (const auto* table : projection.children)
+    {
+        if (table->isMap)
+            readMap(message, *table, id);
+        else
+            readArray(message, *table, id);
+    }
+}
+
+void Database::readColumns(SQLite::Statement& query, google::protobuf::Message* message, const std::vector<TablePlan::Column>& columns, int offset) const
+{
+    for (const auto& column : columns)
+    {
+        if (column.read)
+        {
+            column.read(query.getColumn(column.index + offset), message, column.field);
+        }
+        else
+        {
+            auto nestedMessage = message->GetReflection()->MutableMessage(message, column.field);
+            findMessage(nestedMessage->GetDescriptor()->name(), query.getColumn(column.index + offset).getInt64(), nestedMessage);
+        }
+    }
+}
+
+void Database::readMap(google::protobuf::Message* message, const TablePlan::ChildTable& table, int64_t id) const
+{
+    auto query = statements.acquire({ table.field, StatementCache::Operation::SelectOwned }, [&table]() {
+        return table.selectSql;
+    });
+    query->bind(1, id);
+
+    while (query->executeStep())
+        readEntry(*query, message, table);
+}
+
+void Database::readArray(google::protobuf::Message* message, const TablePlan::ChildTable& table, int64_t id) const
+{
+    auto query = statements.acquire({ table.field, StatementCache::Operation::SelectOwned }, [&table]() {
+        return table.selectSql;
+    });
+    query->bind(1, id);
+
+    while (query->executeStep())
+        readElement(*query, message, table);
+}
+
+void Database::readEntry(SQLite::Statement& query, google::protobuf::Message* message, const TablePlan::ChildTable& table, int offset) const
+{
+    const auto& keyColumn = table.columns[0];
+    const auto& valueColumn = table.columns[1];
+
+    auto entry = message->GetReflection()->AddMessage(message, table.field);
+    keyColumn.read(query.getColumn(keyColumn.index + offset), entry, keyColumn.field);
+
+    if (valueColumn.read)
+        valueColumn.read(query.getColumn(valueColumn.index + offset), entry, valueColumn.field);
+    else
+        readFields(query, entry->GetReflection()->MutableMessage(entry, valueColumn.field), valueColumn.index + offset);
+}
+
+void Database::readElement(SQLite::Statement& query, google::protobuf::Message* message, const TablePlan::ChildTable& table, int offset) const
+{
+    if (table.addElement)
+        table.addElement(query.getColumn(table.columns[0].index + offset), message, table.field);
+    else
+        readFields(query, message->GetReflection()->AddMessage(message, table.field), offset);
+}
+
+std::vector<std::optional<int64_t>> Database::findMessages(std::span<const google::protobuf::Message* const> messages) const
+{
+    std::vector<std::optional<int64_t>> res(messages.size());
+    if (messages.empty())
+        return res;
+
+    const auto& plan = getPlan(messages.front()->GetDescriptor());
+    const auto& keys = getMessageKeys(*messages.front());
+
+    std::string condition;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        if (!condition.empty())
+            condition += " AND ";
+        condition += "t." + keys[i].name + "=v.column" + std::to_string(i + 2);
+    }
+    if (condition.empty())
+        condition = "1";
+
+    // position of a message in the batch goes before its keys, so found rows are matched with messages
+    const size_t rowSize = keys.size() + 1;
+    const size_t variableLimit = sqlite3_limit(database.getHandle(), SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+    const size_t maxRows = std::max<size_t>(1, variableLimit / rowSize);
+
+    for (size_t offset = 0; offset < messages.size();)
+    {
+        const size_t rows = std::min(maxRows, messages.size() - offset);
+
+        auto query = statements.acquire({ plan.descriptor, StatementCache::Operation::SelectIds, static_cast<int64_t>(rows) }, [&plan, &condition, rowSize, rows]() {
+            std::string row = "(?";
+            for (size_t i = 1; i < rowSize; ++i)
+                row += ",?";
+            row += ")";
+
+            std::string sql = "SELECT v.column1, t.id FROM (VALUES ";
+            for (size_t i = 0; i < rows; ++i)
+                sql += i > 0 ? "," + row : row;
+            return sql + ") v JOIN " + plan.tableName + " t ON " + condition + " ORDER BY t.id;";
+        });
+
+        for (size_t row = 0; row < rows; ++row)
+        {
+            const auto& message = *messages[offset + row];
+            query->bind(static_cast<int>(row * rowSize + 1), static_cast<int64_t>(offset + row));
+            insertMessageFields(*query, message, getMessageKeys(message), false, row * rowSize + 1);
+        }
+
+        while (query->executeStep())
+        {
+            auto& id = res[query->getColumn(0).getInt64()];
+            if (!id)
+                id = query->getColumn(1).getInt64();
+        }
+
+        offset += rows;
+    }
+
     return res;
 }
 
-void Database::readFields(SQLite::Statement& query, google::protobuf::Message* message) const
+void Database::findRows(const TablePlan& plan, const google::protobuf::FieldDescriptor* field, std::span<const size_t> positions,
+                        const std::function<void(SQLite::Statement&, int, size_t)>& bindKey,
+                        const std::function<google::protobuf::Message*(size_t)>& createMessage) const
+{
+    const size_t variableLimit = sqlite3_limit(database.getHandle(), SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+    const size_t maxRows = std::max<size_t>(1, variableLimit / 2);
+
+    std::unordered_set<size_t> found;
+    std::vector<std::pair<int64_t, google::protobuf::Message*>> rows;
+    for (size_t offset = 0; offset < positions.size();)
+    {
+        const size_t count = std::min(maxRows, positions.size() - offset);
+
+        // position of a key in the batch is selected with the row, the first row of a key is taken like in findMessage
+        auto query = statements.acquire({ field, StatementCache::Operation::SelectByKeys, static_cast<int64_t>(count) }, [&plan, field, count]() {
+            std::string sql = "SELECT v.column1, t.* FROM (VALUES ";
+            for (size_t i = 0; i < count; ++i)
+                sql += i > 0 ? ",(?,?)" : "(?,?)";
+            return sql + ") v JOIN " + plan.tableName + " t ON t." + getColumnName(field->name()) + "=v.column2 ORDER BY t.id;";
+        });
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            const size_t position = positions[offset + i];
+            query->bind(static_cast<int>(i * 2 + 1), static_cast<int64_t>(position));
+            bindKey(*query, static_cast<int>(i * 2 + 2), position);
+        }
+
+        while (query->executeStep())
+        {
+            const size_t position = static_cast<size_t>(query->getColumn(0).getInt64());
+            if (!found.insert(position).second)
+                continue;
+
+            auto message = createMessage(position);
+            readRow(*query, message, plan, 1);
+            rows.emplace_back(query->getColumn(1).getInt64(), message);
+        }
+
+        offset += count;
+    }
+
+    readChildren(plan, rows);
+}
+
+void Database::readRow(SQLite::Statement& query, google::protobuf::Message* message, const TablePlan& plan, int offset) const
+{
+    if (plan.isBlob)
+    {
+        const auto& data = plan.columns.back();
+        data.read(query.getColumn(data.index + offset), message, data.field);
+        return;
+    }
+
+    readColumns(query, message, plan.columns, offset);
+}
+
+std::vector<int64_t> Database::scanRows(const google::protobuf::Descriptor* descriptor, const google::protobuf::FieldDescriptor* field,
+                                        const std::function<void(SQLite::Statement&, int)>& bindFrom,
+                                        const std::function<void(SQLite::Statement&, int)>& bindTo,
+                                        const ScanOptions& options, std::string& resumeToken,
+                                        const std::function<google::protobuf::Message*()>& createMessage) const
 {
-    for (int column = 1, fieldIndex = 0; fieldIndex < message->GetDescriptor()->field_count(); ++fieldIndex)
+    checkLookupField(descriptor, field);
+    if (field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE)
+        throw std::logic_error("range scan of message field " + field->name());
+
+    const auto& plan = getPlan(descriptor);
+    const auto* column = plan.findColumn(field);
+    if (!column)
+        throw std::logic_error("no column of field " + field->name() + " in " + descriptor->name());
+
+    // token keeps number of the field, ID and type tag with value of the last row: "<number>:<id>:<tag><value>",
+    // NULL value has tag 'n' without value
+    std::optional<int64_t> resumeId;
+    char resumeType = 0;
+    std::string resumeValue;
+    if (!options.resumeToken.empty())
+    {
+        const auto& token = options.resumeToken;
+        const auto first = token.find(':');
+        const auto second = first == std::string::npos ? std::string::npos : token.find(':', first + 1);
+        if (second == std::string::npos || second + 1 >= token.size() || std::stoi(token.substr(0, first)) != field->number())
+            throw std::logic_error("invalid resume token for field " + field->name());
+
+        resumeId = std::stoll(token.substr(first + 1, second - first - 1));
+        resumeType = token[second + 1];
+        resumeValue = token.substr(second + 2);
+        if (std::string_view("irtbn").find(resumeType) == std::string_view::npos)
+            throw std::logic_error("invalid resume token for field " + field->name());
+    }
+
+    const bool descending = options.order == ScanOrder::Descending;
+    const bool resumeNull = resumeType == 'n';
+    const int64_t variant = (bindFrom ? 1 : 0) | (bindTo ? 2 : 0) | (resumeId ? 4 : 0) | (descending ? 8 : 0) | (resumeNull ? 16 : 0);
+    auto query = statements.acquire({ field, StatementCache::Operation::SelectRange, variant }, [&]() {
+        std::string condition;
+        auto addCondition = [&condition](const std::string& text) {
+            condition += condition.empty() ? " WHERE " : " AND ";
+            condition += text;
+        };
+        if (bindFrom)
+            addCondition(column->name + ">=?");
+        if (bindTo)
+            addCondition(column->name + "<?");
+        // NULL goes before all values in SQLite order and doesn't compare with them,
+        // so rows with NULL are selected by separate checks
+        const auto& name = column->name;
+        if (resumeNull)
+            addCondition(descending ? "(" + name + " IS NULL AND id<?)" : "(" + name + " IS NULL AND id>? OR " + name + " IS NOT NULL)");
+        else if (resumeId)
+            addCondition(descending ? "((" + name + ", id)<(?, ?) OR " + name + " IS NULL)" : "(" + name + ", id)>(?, ?)");
+
+        const std::string order = descending ? " DESC" : " ASC";
+        return "SELECT * FROM " + plan.tableName + condition + " ORDER BY " + column->name + order + ", id" + order + " LIMIT ?;";
+    });
+
+    int index = 1;
+    if (bindFrom)
+        bindFrom(*query, index++);
+    if (bindTo)
+        bindTo(*query, index++);
+    if (resumeId)
+    {
+        switch (resumeType)
+        {
+        case 'i':
+            query->bind(index++, static_cast<int64_t>(std::stoll(resumeValue)));
+            break;
+        case 'r':
+            query->bind(index++, std::strtod(resumeValue.c_str(), nullptr));
+            break;
+        case 't':
+            query->bind(index++, resumeValue);
+            break;
+        case 'b':
+            query->bind(index++, resumeValue.data(), static_cast<int>(resumeValue.size()));
+            break;
+        }
+        query->bind(index++, resumeId.value());
+    }
+    // one more row shows whether the next page exists
+    query->bind(index++, options.limit > 0 ? static_cast<int64_t>(options.limit) + 1 : int64_t(-1));
+
+    std::vector<int64_t> ids;
+    std::string lastToken;
+    resumeToken.clear();
+    while (query->executeStep())
     {
-        auto field = message->GetDescriptor()->field(fieldIndex);
-        if (field->is_repeated() && !field->is_map())
+        if (options.limit > 0 && ids.size() == options.limit)
+        {
+            resumeToken = std::move(lastToken);
+            break;
+        }
+
+        ids.emplace_back(query->getColumn(0).getInt64());
+        readRow(*query, createMessage(), plan);
+
+        if (options.limit > 0 && ids.size() == options.limit)
         {
-            std::string tableName = getFieldTableName(message->GetDescriptor(), field);
-            auto messages = findAssociatedMessages(tableName, query.getColumn(0));
-            for (auto msgId : messages)
+            const auto value = query->getColumn(column->index);
+            lastToken = std::to_string(field->number()) + ":" + std::to_string(ids.back()) + ":";
+            if (value.isInteger())
+            {
+                lastToken += 'i' + std::to_string(value.getInt64());
+            }
+            else if (value.isFloat())
+            {
+                char buffer[32];
+                std::snprintf(buffer, sizeof(buffer), "%a", value.getDouble());
+                lastToken += 'r' + std::string(buffer);
+            }
+            else if (value.isText())
+            {
+                lastToken += 't' + value.getString();
+            }
+            else if (value.isBlob())
             {
-                std::string columnName = getColumnName(field->name());
-                SQLite::Statement arrayQuery{ database, "SELECT " + columnName + " FROM " + tableName + " WHERE id=" + std::to_string(msgId) };
-                if (!arrayQuery.executeStep())
-                    throw std::runtime_error("couldn't find object with ID " + std::to_string(msgId) + " in table " + tableName);
+                lastToken += 'b' + std::string(static_cast<const char*>(value.getBlob()), value.getBytes());
+            }
+            else
+            {
+                lastToken += 'n';
+            }
+        }
+    }
 
-                switch(field->cpp_type())
-                {
-                case google::protobuf::FieldDescriptor::CPPTYPE_INT32:
-                    message->GetReflection()->AddInt32(message, field, arrayQuery.getColumn(0));
-                    break;
-                case google::protobuf::FieldDescriptor::CPPTYPE_INT64:
-                    message->GetReflection()->AddInt64(message, field, arrayQuery.getColumn(0));
-                    break;
-                case google::protobuf::FieldDescriptor::CPPTYPE_UINT32:
-                    message->GetReflection()->AddUInt32(message, field, arrayQuery.getColumn(0));
-                    break;
-                case google::protobuf::FieldDescriptor::CPPTYPE_UINT64:
-                    message->GetReflection()->AddUInt64(message, field, static_cast<uint64_t>(arrayQuery.getColumn(0).getInt64()));
-                    break;
-                case google::protobuf::FieldDescriptor::CPPTYPE_DOUBLE:
-                    message->GetReflection()->AddDouble(message, field, arrayQuery.getColumn(0));
-                    break;
-                case google::protobuf::FieldDescriptor::CPPTYPE_FLOAT:
-                    message->GetReflection()->AddFloat(message, field, static_cast<double>(arrayQuery.getColumn(0)));
-                    break;
-                case google::protobuf::FieldDescriptor::CPPTYPE_BOOL:
-                    message->GetReflection()->AddBool(message, field, static_cast<int>(arrayQuery.getColumn(0)));
-                    break;
-                case google::protobuf::FieldDescriptor::CPPTYPE_ENUM:
-                    message->GetReflection()->AddEnumValue(message, field, arrayQuery.getColumn(0));
-                    break;
-                case google::protobuf::FieldDescriptor::CPPTYPE_STRING:
-                    message->GetReflection()->AddString(message, field, arrayQuery.getColumn(0));
-                    break;
-                case google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE:
-                {
-                    auto nestedMessage = message->GetReflection()->AddMessage(message, field);
-                    findMessage(nestedMessage->GetDescriptor()->name(), arrayQuery.getColumn(0), nestedMessage);
-                    break;
-                }
-                default:
-                    throw std::logic_error(std::string{ "unexpected field type: " } + field->cpp_type_name());
-                }
+    return ids;
+}
+
+void Database::checkFieldPath(const google::protobuf::Descriptor* descriptor, const FieldPath& path) const
+{
+    if (path.empty())
+        throw std::logic_error("empty field path for " + descriptor->name());
+
+    for (size_t i = 0; i < path.size(); ++i)
+    {
+        const auto* field = path[i];
+        if (field->containing_type() != descriptor || !getPlan(descriptor).findColumn(field))
+            throw std::logic_error("field " + field->name() + " isn't stored in a column of " + descriptor->name());
+
+        const bool isLast = i + 1 == path.size();
+        if (isLast && field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE)
+            throw std::logic_error("condition on message field " + field->name());
+        if (!isLast && field->cpp_type() != google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE)
+            throw std::logic_error("field " + field->name() + " in the middle of the path isn't a message");
+
+        if (!isLast)
+            descriptor = field->message_type();
+    }
+}
+
+std::string Database::compileQuery(const google::protobuf::Descriptor* descriptor, const QueryFilter& filter, const QueryAggregate* aggregate) const
+{
+    // every prefix of the paths is joined once, tables of nested messages are named in order of their first use
+    std::vector<std::pair<FieldPath, std::string>> aliases;
+    std::string joins;
+    auto getColumn = [this, &aliases, &joins](const FieldPath& path) {
+        std::string alias = "t";
+        for (size_t i = 0; i + 1 < path.size(); ++i)
+        {
+            FieldPath prefix(path.begin(), path.begin() + i + 1);
+            auto it = std::find_if(aliases.begin(), aliases.end(), [&prefix](const auto& entry) { return entry.first == prefix; });
+            if (it == aliases.end())
+            {
+                const std::string next = "j" + std::to_string(aliases.size() + 1);
+                joins += " JOIN " + getPlan(path[i]->message_type()).tableName + " " + next + " ON " + next + ".id=" + alias + "." + getColumnName(path[i]->name());
+                it = aliases.emplace(aliases.end(), std::move(prefix), next);
             }
+            alias = it->second;
+        }
+        return alias + "." + getColumnName(path.back()->name());
+    };
+
+    std::string conditions;
+    for (const auto& condition : filter.conditions)
+    {
+        conditions += conditions.empty() ? " WHERE " : " AND ";
+        conditions += getColumn(condition.path) + getOperator(condition.op) + "?";
+    }
+
+    const auto& tableName = getPlan(descriptor).tableName;
+    std::string sql;
+    if (aggregate)
+    {
+        // values are taken before joins are printed since their paths may add joins
+        const std::string value = aggregate->path.empty() ? "*" : getColumn(aggregate->path);
+        const std::string expression = std::string(getFunctionName(aggregate->function)) + "(" + value + ")";
+        if (aggregate->groupBy.empty())
+        {
+            sql = "SELECT " + expression + " FROM " + tableName + " t" + joins + conditions + ";";
         }
         else
         {
-            switch(field->cpp_type())
+            const std::string group = getColumn(aggregate->groupBy);
+            sql = "SELECT " + group + ", " + expression + " FROM " + tableName + " t" + joins + conditions + " GROUP BY " + group + " ORDER BY " + group + ";";
+        }
+    }
+    else
+    {
+        std::string order;
+        for (const auto& entry : filter.orders)
+            order += getColumn(entry.path) + (entry.order == ScanOrder::Descending ? " DESC, " : " ASC, ");
+        sql = "SELECT t.* FROM " + tableName + " t" + joins + conditions + " ORDER BY " + order + "t.id LIMIT ? OFFSET ?;";
+    }
+
+    return sql;
+}
+
+std::vector<int64_t> Database::selectRows(const google::protobuf::Descriptor* descriptor, const QueryFilter& filter,
+                                          const std::function<google::protobuf::Message*()>& createMessage) const
+{
+    const auto& plan = getPlan(descriptor);
+    const auto sql = compileQuery(descriptor, filter);
+
+    auto query = statements.acquire(sql);
+    int index = 1;
+    for (const auto& condition : filter.conditions)
+        condition.bind(*query, index++);
+    query->bind(index++, filter.limit > 0 ? static_cast<int64_t>(filter.limit) : int64_t(-1));
+    query->bind(index++, static_cast<int64_t>(filter.offset));
+
+    std::vector<int64_t> ids;
+    while (query->executeStep())
+    {
+        ids.emplace_back(query->getColumn(0).getInt64());
+        readRow(*query, createMessage(), plan);
+    }
+    return ids;
+}
+
+int64_t Database::countRows(const google::protobuf::Descriptor* descriptor) const
+{
+    auto query = statements.acquire({ descriptor, StatementCache::Operation::SelectCount }, [this, descriptor]() {
+        return "SELECT COUNT(*) FROM " + getPlan(descriptor).tableName + ";";
+    });
+    query->executeStep();
+    return query->getColumn(0).getInt64();
+}
+
+StatementCache::Handle Database::selectColumns(const google::protobuf::Descriptor* descriptor, std::span<const google::protobuf::FieldDescriptor* const> fields,
+                                               int64_t lastId, size_t limit) const
+{
+    const auto& plan = getPlan(descriptor);
+
+    std::string columns = "id";
+    for (const auto* field : fields)
+    {
+        const auto* column = field->containing_type() == descriptor ? plan.findColumn(field) : nullptr;
+        if (!column || field->cpp_type() == google::protobuf::FieldDescriptor::CPPTYPE_MESSAGE)
+            throw std::logic_error("field " + field->name() + " isn't stored in a scalar column of " + descriptor->name());
+        columns += ", " + column->name;
+    }
+
+    // statements of the same set of fields are shared through the SQL text like statements of queries
+    const auto sql = "SELECT " + columns + " FROM " + plan.tableName + " WHERE id>? ORDER BY id LIMIT ?;";
+    auto query = statements.acquire(sql);
+    query->bind(1, lastId);
+    query->bind(2, static_cast<int64_t>(limit));
+    return query;
+}
+
+StatementCache::Handle Database::selectAggregate(const google::protobuf::Descriptor* descriptor, const QueryFilter& filter, const QueryAggregate& aggregate) const
+{
+    const auto sql = compileQuery(descriptor, filter, &aggregate);
+
+    auto query = statements.acquire(sql);
+    int index = 1;
+    for (const auto& condition : filter.conditions)
+        condition.bind(*query, index++);
+    return query;
+}
+
+void Database::readChildren(const TablePlan& plan, std::span<const std::pair<int64_t, google::protobuf::Message*>> rows) const
+{
+    if (rows.empty() || plan.children.empty())
+        return;
+
+    std::unordered_multimap<int64_t, google::protobuf::Message*> owners;
+    std::vector<int64_t> ids;
+    for (const auto& [id, message] : rows)
+    {
+        if (owners.count(id) == 0)
+            ids.emplace_back(id);
+        owners.emplace(id, message);
+    }
+
+    const size_t variableLimit = sqlite3_limit(database.getHandle(), SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+    for (const auto& table : plan.children)
+    {
+        for (size_t offset = 0; offset < ids.size();)
+        {
+            const size_t count = std::min(variableLimit, ids.size() - offset);
+
+            auto query = statements.acquire({ table.field, StatementCache::Operation::SelectOwners, static_cast<int64_t>(count) }, [&table, count]() {
+                return table.getSelectOwnersSql(count);
+            });
+            for (size_t i = 0; i < count; ++i)
+                query->bind(static_cast<int>(i + 1), ids[offset + i]);
+
+            while (query->executeStep())
             {
-            case google::protobuf::FieldDescriptor::CppType::CPPTYPE_STRING:
-                message->GetReflection()->SetString(message, field, query.getColumn(column));
-                break;
-            case google::protobuf::FieldDescriptor::CppType::CPPTYPE_INT32:
-                message->GetReflection()->SetInt32(message, field, query.getColumn(column));
-                break;
-            case google::protobuf::FieldDescriptor::CppType::CPPTYPE_INT64:
-                message->GetReflection()->SetInt64(message, field, query.getColumn(column));
-                break;
-            case google::protobuf::FieldDescriptor::CppType::CPPTYPE_UINT32:
-                message->GetReflection()->SetUInt32(message, field, query.getColumn(column));
-                break;
-            case google::protobuf::FieldDescriptor::CppType::CPPTYPE_UINT64:
-                message->GetReflection()->SetUInt64(message, field, static_cast<uint64_t>(query.getColumn(0).getInt64()));
-                break;
-            case google::protobuf::FieldDescriptor::CppType::CPPTYPE_BOOL:
-                message->GetReflection()->SetBool(message, field, (static_cast<int>(query.getColumn(column)) != 0 ? true : false));
-                break;
-            case google::protobuf::FieldDescriptor::CppType::CPPTYPE_DOUBLE:
-                message->GetReflection()->SetDouble(message, field, query.getColumn(column));
-                break;
-            case google::protobuf::FieldDescriptor::CppType::CPPTYPE_FLOAT:
-                message->GetReflection()->SetFloat(message, field, static_cast<double>(query.getColumn(column)));
-                break;
-            case google::protobuf::FieldDescriptor::CppType::CPPTYPE_ENUM:
-                message->GetReflection()->SetEnumValue(message, field, query.getColumn(column));
-                break;
-            case google::protobuf::FieldDescriptor::CppType::CPPTYPE_MESSAGE:
-                if (field->is_map())
-                {
-                    auto tableName = getFieldTableName(message->GetDescriptor(), field);
-                    auto messages = findAssociatedMessages(tableName, query.getColumn(0));
-                    for (auto msgId : messages)
-                    {
-                        auto nestedMessage = message->GetReflection()->AddMessage(message, field);
-                        findMessage(tableName, msgId, nestedMessage);
-                    }
-                    continue;
-                }
-                else
+                auto range = owners.equal_range(query->getColumn(0).getInt64());
+                for (auto it = range.first; it != range.second; ++it)
                 {
-                    auto nestedMessage = message->GetReflection()->MutableMessage(message, field);
-                    findMessage(nestedMessage->GetDescriptor()->name(), query.getColumn(column).getInt64(), nestedMessage);
+                    if (table.isMap)
+                        readEntry(*query, it->second, table, 1);
+                    else
+                        readElement(*query, it->second, table, 1);
                 }
-                break;
             }
 
-            ++column;
+            offset += count;
         }
     }
 }
@@ -494,227 +1730,432 @@ std::string Database::getFieldType(const google::protobuf::FieldDescriptor* fiel
     return type;
 }
 
-std::vector<const google::protobuf::FieldDescriptor*> Database::getMessageKeys(const google::protobuf::Message& message, bool strict) const
+const std::vector<TablePlan::Column>& Database::getMessageKeys(const google::protobuf::Message& message, bool strict) const
 {
-    std::vector<const google::protobuf::FieldDescriptor*> res;
+    const auto& plan = getPlan(message.GetDescriptor());
 
-    for (int i = 0; i < message.GetDescriptor()->field_count(); ++i)
+    for (const auto& column : plan.keyColumns)
     {
-        const auto& field = message.GetDescriptor()->field(i);
-        if (field->options().HasExtension(Proto::objectKeyField))
-        {
-            if (field->options().GetExtension(Proto::objectKeyField))
-            {
-                if (!message.GetReflection()->HasField(message, field))
-                    throw std::runtime_error("No key value in key field for " + message.GetTypeName() + " message");
+        if (!message.GetReflection()->HasField(message, column.field))
+            throw std::runtime_error("No key value in key field for " + message.GetTypeName() + " message");
+    }
 
-                res.emplace_back(field);
-            }
+    if (strict)
+        return plan.keyColumns;
+
+    return plan.getLookupColumns();
+}
+
+void Database::insertMessageFields(SQLite::Statement& query, const google::protobuf::Message& message, const std::vector<TablePlan::Column>& columns, bool isInsertion, size_t offset, bool handleConficts) const
+{
+    for (size_t i = 1; i <= columns.size(); ++i)
+    {
+        const auto& column = columns[i - 1];
+
+        if (column.bind)
+        {
+            column.bind(query, i + offset, message, column.field);
+            continue;
         }
+
+        std::optional<int64_t> key;
+        if (isInsertion)
+            key = writeMessageImpl(message.GetReflection()->GetMessage(message, column.field), handleConficts);
+        else
+            key = findMessage(message.GetReflection()->GetMessage(message, column.field));
+
+        if (!key)
+            throw std::runtime_error("No nested object in " + message.GetTypeName() + " message");
+
+        query.bind(i + offset, key.value());
     }
+}
 
-    if (res.empty() && !strict)
+void Database::insertMessageRepeatedField(SQLite::Statement& query, const google::protobuf::Message& message, const TablePlan::ChildTable& table, int index, bool isInsertion) const
+{
+    if (table.bindElement)
     {
-        for (int i = 0; i < message.GetDescriptor()->field_count(); ++i)
-            res.emplace_back(message.GetDescriptor()->field(i));
+        table.bindElement(query, 1, message, table.field, index);
+        return;
     }
 
-    return res;
+    std::optional<int64_t> key;
+    if (isInsertion)
+        key = writeMessageImpl(message.GetReflection()->GetRepeatedMessage(message, table.field, index), false);
+    else
+        key = findMessage(message.GetReflection()->GetRepeatedMessage(message, table.field, index));
+
+    if (!key)
+        throw std::runtime_error("No nested object in " + message.GetTypeName() + " message");
+
+    query.bind(1, key.value());
+}
+
+void Database::writeMap(const google::protobuf::Message& message, const TablePlan::ChildTable& table, int64_t id) const
+{
+    removeMap(table, id);
+
+    auto arraySize = message.GetReflection()->FieldSize(message, table.field);
+    if (arraySize == 0)
+        return;
+
+    auto query = statements.acquire({ table.field, StatementCache::Operation::InsertElement }, [&table]() {
+        return table.insertSql;
+    });
+
+    for (auto i = 0; i < arraySize; ++i)
+    {
+        insertMessageFields(*query, message.GetReflection()->GetRepeatedMessage(message, table.field, i), table.columns, true);
+        query->bind(3, id);
+
+        if (query->exec() != 1)
+            throw std::runtime_error("couldn't insert array values to " + table.name);
+        query->reset();
+    }
 }
 
-void Database::insertMessageFields(SQLite::Statement& query, const google::protobuf::Message& message, const std::vector<const google::protobuf::FieldDescriptor*>& fields, bool isInsertion, size_t offset) const
+void Database::updateMap(const google::protobuf::Message& message, const TablePlan::ChildTable& table, int64_t id) const
 {
-    for (size_t i = 1; i <= fields.size(); ++i)
+    const auto& keyColumn = table.columns[0];
+    const std::vector<TablePlan::Column> valueColumns{ table.columns[1] };
+
+    std::unique_ptr<google::protobuf::Message> stored(message.New());
+    std::vector<int64_t> nestedRows;
+    const auto rows = readStoredElements(stored.get(), table, id, nestedRows);
+
+    std::unordered_map<std::string, std::pair<size_t, const google::protobuf::Message*>> storedEntries;
+    for (size_t i = 0; i < rows.size(); ++i)
     {
-        auto field = fields[i - 1];
+        const auto& entry = stored->GetReflection()->GetRepeatedMessage(*stored, table.field, static_cast<int>(i));
+        storedEntries.emplace(getMapKey(entry, keyColumn.field), std::make_pair(i, &entry));
+    }
+
+    std::vector<const google::protobuf::Message*> inserted;
+    std::vector<std::pair<size_t, const google::protobuf::Message*>> changed;
+    const auto size = message.GetReflection()->FieldSize(message, table.field);
+    for (int i = 0; i < size; ++i)
+    {
+        const auto& entry = message.GetReflection()->GetRepeatedMessage(message, table.field, i);
+        auto it = storedEntries.find(getMapKey(entry, keyColumn.field));
+        if (it == storedEntries.end())
+        {
+            inserted.emplace_back(&entry);
+            continue;
+        }
 
-        if (field->is_repeated() || field->is_map())
-            throw std::logic_error("couldn't insert inappropriate field to the table");
+        if (!equalValues(entry, *it->second.second, valueColumns.front().field))
+            changed.emplace_back(it->second.first, &entry);
+        storedEntries.erase(it);
+    }
 
-        switch (field->cpp_type())
+    if (!storedEntries.empty())
+    {
+        auto query = statements.acquire({ table.field, StatementCache::Operation::DeleteElement }, [&table]() {
+            return table.deleteElementSql;
+        });
+        for (const auto& [key, entry] : storedEntries)
         {
-        case google::protobuf::FieldDescriptor::CppType::CPPTYPE_STRING:
-            query.bind(i + offset, message.GetReflection()->GetString(message, field));
-            break;
-        case google::protobuf::FieldDescriptor::CppType::CPPTYPE_INT32:
-            query.bind(i + offset, message.GetReflection()->GetInt32(message, field));
-            break;
-        case google::protobuf::FieldDescriptor::CppType::CPPTYPE_INT64:
-            query.bind(i + offset, message.GetReflection()->GetInt64(message, field));
-            break;
-        case google::protobuf::FieldDescriptor::CppType::CPPTYPE_UINT32:
-            query.bind(i + offset, message.GetReflection()->GetUInt32(message, field));
-            break;
-        case google::protobuf::FieldDescriptor::CppType::CPPTYPE_UINT64:
-            query.bind(i + offset, static_cast<int64_t>(message.GetReflection()->GetUInt64(message, field)));
-            break;
-        case google::protobuf::FieldDescriptor::CppType::CPPTYPE_BOOL:
-            query.bind(i + offset, message.GetReflection()->GetBool(message, field) ? 1 : 0);
-            break;
-        case google::protobuf::FieldDescriptor::CppType::CPPTYPE_DOUBLE:
-            query.bind(i + offset, message.GetReflection()->GetDouble(message, field));
-            break;
-        case google::protobuf::FieldDescriptor::CppType::CPPTYPE_FLOAT:
-            query.bind(i + offset, message.GetReflection()->GetFloat(message, field));
-            break;
-        case google::protobuf::FieldDescriptor::CppType::CPPTYPE_ENUM:
-            query.bind(i + offset, message.GetReflection()->GetEnumValue(message, field));
-            break;
-        case google::protobuf::FieldDescriptor::CppType::CPPTYPE_MESSAGE:
+            query->bind(1, rows[entry.first]);
+            query->exec();
+            query->reset();
+        }
+    }
+
+    if (!changed.empty())
+    {
+        auto query = statements.acquire({ table.field, StatementCache::Operation::UpdateElement }, [&table]() {
+            return table.updateSql;
+        });
+        for (const auto& [position, entry] : changed)
         {
-            std::optional<int64_t> key;
-            if (isInsertion)
-                key = writeMessageImpl(message.GetReflection()->GetMessage(message, field), false);
+            if (valueColumns.front().bind)
+            {
+                insertMessageFields(*query, *entry, valueColumns, true);
+            }
             else
-                key = findMessage(message.GetReflection()->GetMessage(message, field));
+            {
+                const auto& value = entry->GetReflection()->GetMessage(*entry, valueColumns.front().field);
+                const int64_t nestedId = updateNestedMessage(value, nestedRows[position]);
+                if (nestedId == nestedRows[position])
+                    continue;
+                query->bind(1, nestedId);
+            }
+            query->bind(2, rows[position]);
+            if (query->exec() != 1)
+                throw std::runtime_error("couldn't update map values in " + table.name);
+            query->reset();
+        }
+    }
 
-            if (!key)
-                throw std::runtime_error("No nested object in " + message.GetTypeName() + " message");
+    if (!inserted.empty())
+    {
+        auto query = statements.acquire({ table.field, StatementCache::Operation::InsertElement }, [&table]() {
+            return table.insertSql;
+        });
+        for (const auto* entry : inserted)
+        {
+            insertMessageFields(*query, *entry, table.columns, true);
+            query->bind(3, id);
 
-            query.bind(i + offset, key.value());
-            break;
-        }
-        default:
-            throw std::logic_error(std::string("Unsupported field type: ") + field->cpp_type_name());
+            if (query->exec() != 1)
+                throw std::runtime_error("couldn't insert array values to " + table.name);
+            query->reset();
         }
     }
 }
 
-void Database::insertMessageRepeatedField(SQLite::Statement& query, const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field, bool isInsertion) const
+void Database::removeMap(const TablePlan::ChildTable& table, int64_t id) const
 {
-    switch (field->cpp_type())
+    auto query = statements.acquire({ table.field, StatementCache::Operation::DeleteOwned }, [&table]() {
+        return table.deleteSql;
+    });
+    query->bind(1, id);
+    query->exec();
+}
+
+void Database::writeArray(const google::protobuf::Message& message, const TablePlan::ChildTable& table, int64_t id) const
+{
+    removeArray(table, id);
+    insertArray(message, table, id, 0);
+}
+
+void Database::insertArray(const google::protobuf::Message& message, const TablePlan::ChildTable& table, int64_t id, int begin) const
+{
+    const int arraySize = message.GetReflection()->FieldSize(message, table.field);
+    if (arraySize <= begin)
+        return;
+
+    const auto count = static_cast<size_t>(arraySize - begin);
+    if (table.bindElement)
     {
-    case google::protobuf::FieldDescriptor::CppType::CPPTYPE_STRING:
-        for (size_t i = 1; i <= message.GetReflection()->FieldSize(message, field); ++i)
-            query.bind(i, message.GetReflection()->GetRepeatedString(message, field, i - 1));
-        break;
-    case google::protobuf::FieldDescriptor::CppType::CPPTYPE_INT32:
-        for (size_t i = 1; i <= message.GetReflection()->FieldSize(message, field); ++i)
-            query.bind(i, message.GetReflection()->GetRepeatedInt32(message, field, i - 1));
-        break;
-    case google::protobuf::FieldDescriptor::CppType::CPPTYPE_INT64:
-        for (size_t i = 1; i <= message.GetReflection()->FieldSize(message, field); ++i)
-            query.bind(i, message.GetReflection()->GetRepeatedInt64(message, field, i - 1));
-        break;
-    case google::protobuf::FieldDescriptor::CppType::CPPTYPE_UINT32:
-        for (size_t i = 1; i <= message.GetReflection()->FieldSize(message, field); ++i)
-            query.bind(i, message.GetReflection()->GetRepeatedUInt32(message, field, i - 1));
-        break;
-    case google::protobuf::FieldDescriptor::CppType::CPPTYPE_UINT64:
-        for (size_t i = 1; i <= message.GetReflection()->FieldSize(message, field); ++i)
-            query.bind(i, static_cast<int64_t>(message.GetReflection()->GetRepeatedUInt64(message, field, i - 1)));
-        break;
-    case google::protobuf::FieldDescriptor::CppType::CPPTYPE_BOOL:
-        for (size_t i = 1; i <= message.GetReflection()->FieldSize(message, field); ++i)
-            query.bind(i, message.GetReflection()->GetRepeatedBool(message, field, i - 1) ? 1 : 0);
-        break;
-    case google::protobuf::FieldDescriptor::CppType::CPPTYPE_DOUBLE:
-        for (size_t i = 1; i <= message.GetReflection()->FieldSize(message, field); ++i)
-            query.bind(i, message.GetReflection()->GetRepeatedDouble(message, field, i - 1));
-        break;
-    case google::protobuf::FieldDescriptor::CppType::CPPTYPE_FLOAT:
-        for (size_t i = 1; i <= message.GetReflection()->FieldSize(message, field); ++i)
-            query.bind(i, message.GetReflection()->GetRepeatedFloat(message, field, i - 1));
-        break;
-    case google::protobuf::FieldDescriptor::CppType::CPPTYPE_ENUM:
-        for (size_t i = 1; i <= message.GetReflection()->FieldSize(message, field); ++i)
-            query.bind(i, message.GetReflection()->GetRepeatedEnumValue(message, field, i - 1));
-        break;
-    case google::protobuf::FieldDescriptor::CppType::CPPTYPE_MESSAGE:
+        appendElements(table, id, count, [&message, &table, begin](SQLite::Statement& query, int index, size_t element) {
+            table.bindElement(query, index, message, table.field, begin + static_cast<int>(element));
+        });
+        return;
+    }
+
+    // nested messages are written before the statement of elements is leased
+    std::vector<int64_t> nestedIds;
+    nestedIds.reserve(count);
+    for (int i = begin; i < arraySize; ++i)
+        nestedIds.emplace_back(writeMessageImpl(message.GetReflection()->GetRepeatedMessage(message, table.field, i), false));
+
+    appendElements(table, id, count, [&nestedIds](SQLite::Statement& query, int index, size_t element) {
+        query.bind(index, nestedIds[element]);
+    });
+}
+
+void Database::updateArray(const google::protobuf::Message& message, const TablePlan::ChildTable& table, int64_t id) const
+{
+    // elements are ordered by row ID, so changed positions are updated in place
+    // and only the difference of lengths is inserted or deleted
+    std::unique_ptr<google::protobuf::Message> stored(message.New());
+    std::vector<int64_t> nestedRows;
+    const auto rows = readStoredElements(stored.get(), table, id, nestedRows);
+
+    const int size = message.GetReflection()->FieldSize(message, table.field);
+    const int common = std::min(size, static_cast<int>(rows.size()));
+
+    std::vector<int> changed;
+    for (int i = 0; i < common; ++i)
     {
-        for (size_t i = 1; i <= message.GetReflection()->FieldSize(message, field); ++i)
+        if (!equalElements(message, *stored, table.field, i))
+            changed.emplace_back(i);
+    }
+
+    if (!changed.empty())
+    {
+        auto query = statements.acquire({ table.field, StatementCache::Operation::UpdateElement }, [&table]() {
+            return table.updateSql;
+        });
+        for (int i : changed)
         {
-            std::optional<int64_t> key;
-            if (isInsertion)
-                key = writeMessageImpl(message.GetReflection()->GetRepeatedMessage(message, field, i - 1), false);
+            if (table.bindElement)
+            {
+                table.bindElement(*query, 1, message, table.field, i);
+            }
             else
-                key = findMessage(message.GetReflection()->GetRepeatedMessage(message, field, i - 1));
-
-            if (!key)
-                throw std::runtime_error("No nested object in " + message.GetTypeName() + " message");
-
-            query.bind(i, key.value());
+            {
+                const auto& element = message.GetReflection()->GetRepeatedMessage(message, table.field, i);
+                const int64_t nestedId = updateNestedMessage(element, nestedRows[i]);
+                if (nestedId == nestedRows[i])
+                    continue;
+                query->bind(1, nestedId);
+            }
+            query->bind(2, rows[i]);
+            if (query->exec() != 1)
+                throw std::runtime_error("couldn't update array values in " + table.name);
+            query->reset();
         }
-        break;
     }
-    default:
-        throw std::logic_error(std::string("Unsupported field type: ") + field->cpp_type_name());
+
+    if (size < static_cast<int>(rows.size()))
+    {
+        auto query = statements.acquire({ table.field, StatementCache::Operation::DeleteElement }, [&table]() {
+            return table.deleteTailSql;
+        });
+        query->bind(1, id);
+        query->bind(2, rows[size]);
+        query->exec();
     }
+
+    insertArray(message, table, id, common);
 }
 
-void Database::writeMap(const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field, int64_t id) const
+std::vector<int64_t> Database::readStoredElements(google::protobuf::Message* stored, const TablePlan::ChildTable& table, int64_t id, std::vector<int64_t>& nestedRows) const
 {
-    removeMap(message, field, id);
+    std::vector<int64_t> rows;
+
+    const bool isNested = table.isMap ? !table.columns[1].read : !table.addElement;
+    if (!isNested)
+    {
+        auto query = statements.acquire({ table.field, StatementCache::Operation::SelectOwned }, [&table]() {
+            return table.selectSql;
+        });
+        query->bind(1, id);
 
-    std::string idStr = std::to_string(id);
-    std::string values;
+        while (query->executeStep())
+        {
+            rows.emplace_back(query->getColumn(0).getInt64());
+            if (table.isMap)
+                readEntry(*query, stored, table);
+            else
+                readElement(*query, stored, table);
+        }
+        return rows;
+    }
 
-    auto arraySize = message.GetReflection()->FieldSize(message, field);
-    if (arraySize == 0)
-        return;
+    // nested messages are read with their own children, IDs of rows and of nested rows come by a separate query in the same order
+    if (table.isMap)
+        readMap(stored, table, id);
+    else
+        readArray(stored, table, id);
 
-    for (int i = 0; i < arraySize; ++i)
+    auto query = statements.acquire({ table.field, StatementCache::Operation::SelectIds }, [&table]() {
+        return table.selectRowsSql;
+    });
+    query->bind(1, id);
+
+    while (query->executeStep())
     {
-        if (!values.empty())
-            values += ',';
-        values += "(?,?," + idStr + ")";
+        rows.emplace_back(query->getColumn(0).getInt64());
+        nestedRows.emplace_back(query->getColumn(1).getInt64());
     }
+    return rows;
+}
 
-    std::string fullSQL = "INSERT INTO " + getFieldTableName(message.GetDescriptor(), field) + "(" +
-                            getColumnName(field->message_type()->map_key()->name()) + ", " +
-                            getColumnName(field->message_type()->map_value()->name()) + ", "
-                            "owner_id) "
-                          "VALUES " + values + ";";
-    SQLite::Statement query(database, fullSQL);
-    std::vector<const google::protobuf::FieldDescriptor*> fields{ field->message_type()->map_key(), field->message_type()->map_value() };
+int64_t Database::updateNestedMessage(const google::protobuf::Message& message, int64_t storedId) const
+{
+    const auto& plan = getPlan(message.GetDescriptor());
 
-    for (auto i = 0; i < arraySize; ++i)
-        insertMessageFields(query, message.GetReflection()->GetRepeatedMessage(message, field, i), fields, true, i * 2);
+    // messages with keys may be referred by several owners, so they are upserted by the key,
+    // other ones belong to the element and are updated in their row
+    if (!plan.keyColumns.empty())
+        return writeMessageImpl(message, true);
 
-    if (query.exec() != arraySize)
-        throw std::runtime_error("couldn't insert array values to " + getFieldTableName(message.GetDescriptor(), field));
+    updateRow(plan, message, storedId);
+    return storedId;
 }
 
-void Database::removeMap(const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field, int64_t id) const
+void Database::updateRow(const TablePlan& plan, const google::protobuf::Message& message, int64_t id) const
 {
-    std::string fullSQL = "DELETE FROM " + getFieldTableName(message.GetDescriptor(), field) + " WHERE owner_id=" + std::to_string(id);
-    SQLite::Statement query(database, fullSQL);
-    query.exec();
+    if (!plan.columns.empty())
+    {
+        // rows of nested messages are taken from the stored row before the statement of update is leased
+        std::vector<int64_t> nestedIds(plan.columns.size());
+        if (std::any_of(plan.columns.begin(), plan.columns.end(), [](const auto& column) { return !column.bind; }))
+        {
+            std::vector<int64_t> storedIds(plan.columns.size());
+            {
+                auto query = statements.acquire({ plan.descriptor, StatementCache::Operation::SelectById }, [&plan]() {
+                    return plan.selectByIdSql;
+                });
+                query->bind(1, id);
+                if (!query->executeStep())
+                    throw std::runtime_error("couldn't find object with type " + plan.tableName + " and ID " + std::to_string(id));
+                for (size_t i = 0; i < plan.columns.size(); ++i)
+                {
+                    if (!plan.columns[i].bind)
+                        storedIds[i] = query->getColumn(plan.columns[i].index).getInt64();
+                }
+            }
+
+            for (size_t i = 0; i < plan.columns.size(); ++i)
+            {
+                const auto& column = plan.columns[i];
+                if (!column.bind)
+                    nestedIds[i] = updateNestedMessage(message.GetReflection()->GetMessage(message, column.field), storedIds[i]);
+            }
+        }
+
+        auto query = statements.acquire({ plan.descriptor, StatementCache::Operation::Update }, [&plan]() {
+            return plan.updateSql;
+        });
+        for (size_t i = 0; i < plan.columns.size(); ++i)
+        {
+            const auto& column = plan.columns[i];
+            if (column.bind)
+                column.bind(*query, static_cast<int>(i) + 1, message, column.field);
+            else
+                query->bind(static_cast<int>(i) + 1, nestedIds[i]);
+        }
+        query->bind(static_cast<int>(plan.columns.size()) + 1, id);
+        if (query->exec() != 1)
+            throw std::runtime_error("couldn't update message in " + plan.tableName);
+    }
+
+    writeChildren(plan, message, id, true);
 }
 
-void Database::writeArray(const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field, int64_t id) const
+const TablePlan::ChildTable& Database::getChildTable(const google::protobuf::Descriptor* descriptor, const google::protobuf::FieldDescriptor* field) const
 {
-    removeArray(message, field, id);
+    const auto& plan = getPlan(descriptor);
+    if (field->containing_type() != descriptor)
+        throw std::logic_error("field " + field->name() + " doesn't belong to " + descriptor->name());
 
-    std::string idStr = std::to_string(id);
+    for (const auto& table : plan.children)
+    {
+        if (table.field == field)
+            return table;
+    }
 
-    auto arraySize = message.GetReflection()->FieldSize(message, field);
-    if (arraySize == 0)
-        return;
+    if (plan.isBlob)
+        throw std::logic_error("field " + field->name() + " is stored in serialized data of " + descriptor->name());
+    throw std::logic_error("field " + field->name() + " of " + descriptor->name() + " has no table of elements");
+}
+
+void Database::appendElements(const TablePlan::ChildTable& table, int64_t id, size_t count, const std::function<void(SQLite::Statement&, int, size_t)>& bindElement) const
+{
+    const size_t variableLimit = sqlite3_limit(database.getHandle(), SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+    const size_t maxRows = std::max<size_t>(1, variableLimit / 2);
 
-    std::string values;
-    for (int i = 0; i < arraySize; ++i)
+    for (size_t offset = 0; offset < count;)
     {
-        if (!values.empty())
-            values += ',';
-        values += "(?," + idStr + ")";
-    }
+        const size_t rows = getChunkRows(count - offset, maxRows);
 
-    std::string fullSQL = "INSERT INTO " + getFieldTableName(message.GetDescriptor(), field) + "(" + getColumnName(field->name()) + ",owner_id) "
-                          "VALUES " + values + ";";
-    SQLite::Statement query(database, fullSQL);
+        auto query = statements.acquire({ table.field, StatementCache::Operation::InsertRows, static_cast<int64_t>(rows) }, [&table, rows]() {
+            return table.getInsertSql(rows);
+        });
+        for (size_t row = 0; row < rows; ++row)
+        {
+            bindElement(*query, static_cast<int>(row * 2 + 1), offset + row);
+            query->bind(static_cast<int>(row * 2 + 2), id);
+        }
 
-    insertMessageRepeatedField(query, message, field, true);
+        if (query->exec() != static_cast<int>(rows))
+            throw std::runtime_error("couldn't insert array values to " + table.name);
 
-    if (query.exec() != arraySize)
-        throw std::runtime_error("couldn't insert array values to " + getFieldTableName(message.GetDescriptor(), field));
+        offset += rows;
+    }
 }
 
-void Database::removeArray(const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field, int64_t id) const
+void Database::removeArray(const TablePlan::ChildTable& table, int64_t id) const
 {
-    std::string fullSQL = "DELETE FROM " + getFieldTableName(message.GetDescriptor(), field) + " WHERE owner_id=" + std::to_string(id);
-    SQLite::Statement query(database, fullSQL);
-    query.exec();
+    auto query = statements.acquire({ table.field, StatementCache::Operation::DeleteOwned }, [&table]() {
+        return table.deleteSql;
+    });
+    query->bind(1, id);
+    query->exec();
 }
 
 void Database::clearTableImpl(const std::string& type)
@@ -0,0 +1,142 @@
+#include <ProtoDatabase/DatabasePool.h>
+
+
+namespace ProtoDatabase
+{
+
+namespace
+{
+
+DatabaseOptions getWriterOptions(const std::string& path, const DatabaseOptions& options)
+{
+    if (path.empty() || path == ":memory:")
+        throw std::logic_error("connections of the pool need a database file");
+
+    DatabaseOptions res = options;
+    res.journalMode = DatabaseOptions::JournalMode::Wal;
+    res.readOnly = false;
+    return res;
+}
+
+DatabaseOptions getReaderOptions(const DatabaseOptions& options)
+{
+    // journal mode and page size are settings of the file, they are set by the writer
+    DatabaseOptions res = options;
+    res.journalMode = DatabaseOptions::JournalMode::Default;
+    res.pageSize.reset();
+    res.readOnly = true;
+    // caches of readers aren't notified about changes made by the writer
+    res.messageCacheCapacity = 0;
+    return res;
+}
+
+}
+
+DatabasePool::Reader::Reader(DatabasePool& pool, Database* database) : pool(&pool), database(database)
+{}
+
+DatabasePool::Reader::Reader(Reader&& other) noexcept : pool(other.pool), database(other.database)
+{
+    other.database = nullptr;
+}
+
+DatabasePool::Reader& DatabasePool::Reader::operator=(Reader&& other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        pool = other.pool;
+        database = other.database;
+        other.database = nullptr;
+    }
+    return *this;
+}
+
+DatabasePool::Reader::~Reader()
+{
+    release();
+}
+
+void DatabasePool::Reader::release() noexcept
+{
+    if (!database)
+        return;
+
+    pool->release(database);
+    database = nullptr;
+}
+
+DatabasePool::DatabasePool(const std::string& path, size_t readers, const DatabaseOptions& options) :
+    writer(path, getWriterOptions(path, options))
+{
+    if (readers == 0)
+        throw std::logic_error("pool needs at least one reading connection");
+
+    const auto readerOptions = getReaderOptions(options);
+    for (size_t i = 0; i < readers; ++i)
+    {
+        this->readers.emplace_back(std::make_unique<Database>(path, readerOptions));
+        idleReaders.push_back(this->readers.back().get());
+    }
+}
+
+DatabasePool::Reader DatabasePool::acquireReader()
+{
+    std::unique_lock lock(readersMutex);
+    readerReleased.wait(lock, [this]() { return !idleReaders.empty(); });
+
+    Database* reader = idleReaders.back();
+    idleReaders.pop_back();
+    return Reader(*this, reader);
+}
+
+DatabasePool::Writer DatabasePool::acquireWriter()
+{
+    return Writer(writerMutex, &writer);
+}
+
+void DatabasePool::createTable(const google::protobuf::Message& message)
+{
+    acquireWriter()->createTable(message);
+}
+
+int64_t DatabasePool::insertMessage(const google::protobuf::Message& message)
+{
+    return acquireWriter()->insertMessage(message);
+}
+
+int64_t DatabasePool::writeMessage(const google::protobuf::Message& message)
+{
+    return acquireWriter()->writeMessage(message);
+}
+
+std::vector<int64_t> DatabasePool::insertMessages(std::span<const google::protobuf::Message* const> messages)
+{
+    return acquireWriter()->insertMessages(messages);
+}
+
+std::vector<int64_t> DatabasePool::writeMessages(std::span<const google::protobuf::Message* const> messages)
+{
+    return acquireWriter()->writeMessages(messages);
+}
+
+void DatabasePool::deleteMessage(const google::protobuf::Message& message)
+{
+    acquireWriter()->deleteMessage(message);
+}
+
+void DatabasePool::clearTable(const std::string& type)
+{
+    acquireWriter()->clearTable(type);
+}
+
+void DatabasePool::release(Database* reader) noexcept
+{
+    {
+        std::lock_guard lock(readersMutex);
+        idleReaders.push_back(reader);
+    }
+    readerReleased.notify_one();
+}
+
+}
@@ -0,0 +1,88 @@
+#include <ProtoDatabase/DatabaseStats.h>
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+
+namespace ProtoDatabase
+{
+
+void LatencyHistogram::record(std::chrono::nanoseconds duration)
+{
+    const auto value = static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0));
+    const size_t bucket = std::min<size_t>(std::bit_width(value), bucketCount - 1);
+
+    ++buckets[bucket];
+    ++count;
+    total += duration;
+    max = std::max(max, duration);
+}
+
+std::chrono::nanoseconds LatencyHistogram::getPercentile(double rank) const
+{
+    if (count == 0)
+        return std::chrono::nanoseconds{ 0 };
+
+    const auto target = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(std::clamp(rank, 0.0, 1.0) * count)));
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucketCount - 1; ++i)
+    {
+        seen += buckets[i];
+        if (seen >= target)
+            return std::min(max, std::chrono::nanoseconds{ int64_t{ 1 } << i });
+    }
+    return max;
+}
+
+std::chrono::nanoseconds LatencyHistogram::getMean() const
+{
+    return count == 0 ? std::chrono::nanoseconds{ 0 } : total / static_cast<int64_t>(count);
+}
+
+const char* DatabaseStats::getOperationName(Operation operation)
+{
+    switch (operation)
+    {
+    case Operation::CreateTable:
+        return "createTable";
+    case Operation::InsertMessage:
+        return "insertMessage";
+    case Operation::WriteMessage:
+        return "writeMessage";
+    case Operation::InsertMessages:
+        return "insertMessages";
+    case Operation::WriteMessages:
+        return "writeMessages";
+    case Operation::FindMessage:
+        return "findMessage";
+    case Operation::FindAllMessages:
+        return "findAllMessages";
+    case Operation::FindMessages:
+        return "findMessages";
+    case Operation::GetAllMessages:
+        return "getAllMessages";
+    case Operation::ScanMessages:
+        return "forEachMessage";
+    case Operation::ScanRange:
+        return "scanRange";
+    case Operation::QueryMessages:
+        return "query";
+    case Operation::Aggregate:
+        return "aggregate";
+    case Operation::GetValue:
+        return "getValue";
+    case Operation::GetColumns:
+        return "getColumns";
+    case Operation::DeleteMessage:
+        return "deleteMessage";
+    case Operation::AppendRepeated:
+        return "appendRepeated";
+    case Operation::ClearTable:
+        return "clearTable";
+    }
+    return "unknown";
+}
+
+}
@@ -0,0 +1,198 @@
+#include <ProtoDatabase/MessageCache.h>
+
+#include <google/protobuf/descriptor.h>
+
+#include <algorithm>
+#include <vector>
+
+
+namespace ProtoDatabase
+{
+
+MessageCache::MessageCache(size_t capacity) : capacity(capacity)
+{}
+
+void MessageCache::invalidate(const google::protobuf::Descriptor* descriptor)
+{
+    if (typeEntries.empty())
+        return;
+
+    std::vector<const google::protobuf::Descriptor*> types;
+    for (const auto& type : typeEntries)
+    {
+        if (isRelated(type.first, descriptor))
+            types.emplace_back(type.first);
+    }
+    if (types.empty())
+        return;
+
+    ++invalidations;
+    for (auto it = recentlyUsed.begin(); it != recentlyUsed.end();)
+    {
+        auto current = it++;
+        if (std::find(types.begin(), types.end(), current->key.field->containing_type()) != types.end())
+            erase(current);
+    }
+}
+
+void MessageCache::registerType(const google::protobuf::Descriptor* descriptor)
+{
+    getNestedTypes(descriptor);
+}
+
+void MessageCache::invalidate(const std::string& typeName)
+{
+    if (recentlyUsed.empty())
+        return;
+
+    std::unordered_set<const google::protobuf::Descriptor*> types;
+    for (const auto& type : nestedTypes)
+    {
+        for (const auto* nested : type.second)
+        {
+            if (nested->name() == typeName)
+                types.insert(nested);
+        }
+    }
+
+    // relations of an unknown type can't be checked
+    if (types.empty())
+    {
+        clear();
+        return;
+    }
+
+    for (const auto* type : types)
+        invalidate(type);
+}
+
+void MessageCache::setCapacity(size_t capacity)
+{
+    this->capacity = capacity;
+    shrink();
+}
+
+void MessageCache::clear()
+{
+    if (!recentlyUsed.empty())
+        ++invalidations;
+
+    recentlyUsed.clear();
+    entries.clear();
+    typeEntries.clear();
+    size = 0;
+}
+
+MessageCache::Stats MessageCache::getStats() const
+{
+    return Stats{ hits, misses, evictions, invalidations, entries.size(), size, capacity };
+}
+
+void MessageCache::resetStats()
+{
+    hits = 0;
+    misses = 0;
+    evictions = 0;
+    invalidations = 0;
+}
+
+size_t MessageCache::KeyHash::operator()(const Key& key) const noexcept
+{
+    size_t res = std::hash<const void*>{}(key.field);
+    res ^= std::hash<std::string>{}(key.value) + 0x9e3779b9 + (res << 6) + (res >> 2);
+    return res;
+}
+
+std::shared_ptr<const google::protobuf::Message> MessageCache::findEncoded(const google::protobuf::FieldDescriptor* field, std::string key)
+{
+    auto it = entries.find(Key{ field, std::move(key) });
+    if (it == entries.end())
+    {
+        ++misses;
+        return {};
+    }
+
+    ++hits;
+    recentlyUsed.splice(recentlyUsed.begin(), recentlyUsed, it->second);
+    return it->second->message;
+}
+
+void MessageCache::insertEncoded(const google::protobuf::FieldDescriptor* field, std::string key, const google::protobuf::Message& message)
+{
+    Key entryKey{ field, std::move(key) };
+    if (auto it = entries.find(entryKey); it != entries.end())
+        erase(it->second);
+
+    std::shared_ptr<google::protobuf::Message> copy(message.New());
+    copy->CopyFrom(message);
+
+    const size_t entrySize = copy->SpaceUsedLong() + entryKey.value.size() + sizeof(Entry);
+    if (entrySize > capacity)
+        return;
+
+    // the type is remembered to find types related to it on invalidation
+    getNestedTypes(field->containing_type());
+
+    recentlyUsed.push_front(Entry{ entryKey, std::move(copy), entrySize });
+    entries.emplace(std::move(entryKey), recentlyUsed.begin());
+    ++typeEntries[field->containing_type()];
+    size += entrySize;
+
+    shrink();
+}
+
+void MessageCache::erase(std::list<Entry>::iterator entry)
+{
+    const auto* type = entry->key.field->containing_type();
+    if (--typeEntries[type] == 0)
+        typeEntries.erase(type);
+
+    size -= entry->size;
+    entries.erase(entry->key);
+    recentlyUsed.erase(entry);
+}
+
+void MessageCache::shrink()
+{
+    while (size > capacity && !recentlyUsed.empty())
+    {
+        erase(std::prev(recentlyUsed.end()));
+        ++evictions;
+    }
+}
+
+bool MessageCache::isRelated(const google::protobuf::Descriptor* cached, const google::protobuf::Descriptor* changed)
+{
+    // rows of nested types are written and deleted together with rows of their owners, so a write changes
+    // messages of every type reaching any of them: owners, nested types and other owners of the same nested types
+    const auto& cachedTypes = getNestedTypes(cached);
+    const auto& changedTypes = getNestedTypes(changed);
+    const auto& smaller = cachedTypes.size() < changedTypes.size() ? cachedTypes : changedTypes;
+    const auto& larger = cachedTypes.size() < changedTypes.size() ? changedTypes : cachedTypes;
+    return std::any_of(smaller.begin(), smaller.end(), [&larger](const auto* type) { return larger.count(type) != 0; });
+}
+
+const std::unordered_set<const google::protobuf::Descriptor*>& MessageCache::getNestedTypes(const google::protobuf::Descriptor* descriptor)
+{
+    auto it = nestedTypes.find(descriptor);
+    if (it != nestedTypes.end())
+        return it->second;
+
+    std::unordered_set<const google::protobuf::Descriptor*> res{ descriptor };
+    std::vector<const google::protobuf::Descriptor*> pending{ descriptor };
+    while (!pending.empty())
+    {
+        const auto* type = pending.back();
+        pending.pop_back();
+        for (int i = 0; i < type->field_count(); ++i)
+        {
+            const auto* nested = type->field(i)->message_type();
+            if (nested && res.insert(nested).second)
+                pending.push_back(nested);
+        }
+    }
+
+    return nestedTypes.emplace(descriptor, std::move(res)).first->second;
+}
+
+}
@@ -0,0 +1,132 @@
+#include <ProtoDatabase/StatementCache.h>
+
+
+namespace ProtoDatabase
+{
+
+StatementCache::Entry::Entry(const SQLite::Database& database, const std::string& query) : statement(database, query)
+{}
+
+StatementCache::Handle::Handle(std::shared_ptr<Entry> entry) : entry(std::move(entry))
+{
+    this->entry->inUse = true;
+}
+
+StatementCache::Handle& StatementCache::Handle::operator=(Handle&& other) noexcept
+{
+    if (this != &other)
+    {
+        release();
+        entry = std::move(other.entry);
+    }
+    return *this;
+}
+
+StatementCache::Handle::~Handle()
+{
+    release();
+}
+
+void StatementCache::Handle::release() noexcept
+{
+    if (!entry)
+        return;
+
+    entry->statement.tryReset();
+    try
+    {
+        entry->statement.clearBindings();
+    }
+    catch (...)
+    {}
+    entry->inUse = false;
+    entry.reset();
+}
+
+StatementCache::StatementCache(const SQLite::Database& database, size_t capacity) :
+    database(database),
+    capacity(capacity)
+{}
+
+StatementCache::Handle StatementCache::acquire(const std::string& query)
+{
+    Key key{ nullptr, Operation::SelectQuery, 0, query };
+    if (auto entry = lookup(key))
+        return Handle{ std::move(entry) };
+    return prepare(key, query);
+}
+
+void StatementCache::setCapacity(size_t capacity)
+{
+    this->capacity = capacity;
+    shrink();
+}
+
+void StatementCache::clear()
+{
+    entries.clear();
+    recentlyUsed.clear();
+}
+
+StatementCache::Stats StatementCache::getStats() const
+{
+    return Stats{ hits, misses, evictions, entries.size(), capacity };
+}
+
+void StatementCache::resetStats()
+{
+    hits = 0;
+    misses = 0;
+    evictions = 0;
+}
+
+size_t StatementCache::KeyHash::operator()(const Key& key) const noexcept
+{
+    size_t res = std::hash<const void*>{}(key.object);
+    res ^= std::hash<int>{}(static_cast<int>(key.operation)) + 0x9e3779b9 + (res << 6) + (res >> 2);
+    res ^= std::hash<int64_t>{}(key.variant) + 0x9e3779b9 + (res << 6) + (res >> 2);
+    if (!key.query.empty())
+        res ^= std::hash<std::string>{}(key.query) + 0x9e3779b9 + (res << 6) + (res >> 2);
+    return res;
+}
+
+std::shared_ptr<StatementCache::Entry> StatementCache::lookup(const Key& key)
+{
+    auto it = entries.find(key);
+    if (it == entries.end() || it->second->inUse)
+        return {};
+
+    ++hits;
+    recentlyUsed.splice(recentlyUsed.begin(), recentlyUsed, it->second->position);
+    return it->second;
+}
+
+StatementCache::Handle StatementCache::prepare(const Key& key, const std::string& query)
+{
+    ++misses;
+
+    auto entry = std::make_shared<Entry>(database, query);
+
+    // statement of the same shape is used up the stack (recursive message types), so the new one isn't cached
+    if (capacity == 0 || entries.count(key) != 0)
+        return Handle{ std::move(entry) };
+
+    recentlyUsed.push_front(key);
+    entry->position = recentlyUsed.begin();
+    entries.emplace(key, entry);
+    shrink();
+
+    return Handle{ std::move(entry) };
+}
+
+void StatementCache::shrink()
+{
+    while (entries.size() > capacity)
+    {
+        entries.erase(recentlyUsed.back());
+        recentlyUsed.pop_back();
+        ++evictions;
+    }
+}
+
+}
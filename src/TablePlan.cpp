@@ -0,0 +1,323 @@
+#include <ProtoDatabase/TablePlan.h>
+
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+
+namespace ProtoDatabase
+{
+
+namespace
+{
+
+using CppType = google::protobuf::FieldDescriptor::CppType;
+
+template<CppType type>
+void bindField(SQLite::Statement& query, int index, const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field)
+{
+    const auto* reflection = message.GetReflection();
+    if constexpr (type == CppType::CPPTYPE_STRING)
+        query.bind(index, reflection->GetString(message, field));
+    else if constexpr (type == CppType::CPPTYPE_INT32)
+        query.bind(index, reflection->GetInt32(message, field));
+    else if constexpr (type == CppType::CPPTYPE_INT64)
+        query.bind(index, reflection->GetInt64(message, field));
+    else if constexpr (type == CppType::CPPTYPE_UINT32)
+        query.bind(index, reflection->GetUInt32(message, field));
+    else if constexpr (type == CppType::CPPTYPE_UINT64)
+        query.bind(index, static_cast<int64_t>(reflection->GetUInt64(message, field)));
+    else if constexpr (type == CppType::CPPTYPE_BOOL)
+        query.bind(index, reflection->GetBool(message, field) ? 1 : 0);
+    else if constexpr (type == CppType::CPPTYPE_DOUBLE)
+        query.bind(index, reflection->GetDouble(message, field));
+    else if constexpr (type == CppType::CPPTYPE_FLOAT)
+        query.bind(index, reflection->GetFloat(message, field));
+    else if constexpr (type == CppType::CPPTYPE_ENUM)
+        query.bind(index, reflection->GetEnumValue(message, field));
+}
+
+template<CppType type>
+void bindElement(SQLite::Statement& query, int index, const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field, int element)
+{
+    const auto* reflection = message.GetReflection();
+    if constexpr (type == CppType::CPPTYPE_STRING)
+        query.bind(index, reflection->GetRepeatedString(message, field, element));
+    else if constexpr (type == CppType::CPPTYPE_INT32)
+        query.bind(index, reflection->GetRepeatedInt32(message, field, element));
+    else if constexpr (type == CppType::CPPTYPE_INT64)
+        query.bind(index, reflection->GetRepeatedInt64(message, field, element));
+    else if constexpr (type == CppType::CPPTYPE_UINT32)
+        query.bind(index, reflection->GetRepeatedUInt32(message, field, element));
+    else if constexpr (type == CppType::CPPTYPE_UINT64)
+        query.bind(index, static_cast<int64_t>(reflection->GetRepeatedUInt64(message, field, element)));
+    else if constexpr (type == CppType::CPPTYPE_BOOL)
+        query.bind(index, reflection->GetRepeatedBool(message, field, element) ? 1 : 0);
+    else if constexpr (type == CppType::CPPTYPE_DOUBLE)
+        query.bind(index, reflection->GetRepeatedDouble(message, field, element));
+    else if constexpr (type == CppType::CPPTYPE_FLOAT)
+        query.bind(index, reflection->GetRepeatedFloat(message, field, element));
+    else if constexpr (type == CppType::CPPTYPE_ENUM)
+        query.bind(index, reflection->GetRepeatedEnumValue(message, field, element));
+}
+
+template<CppType type>
+void readField(const SQLite::Column& column, google::protobuf::Message* message, const google::protobuf::FieldDescriptor* field)
+{
+    const auto* reflection = message->GetReflection();
+    if constexpr (type == CppType::CPPTYPE_STRING)
+        reflection->SetString(message, field, column.getString());
+    else if constexpr (type == CppType::CPPTYPE_INT32)
+        reflection->SetInt32(message, field, column.getInt());
+    else if constexpr (type == CppType::CPPTYPE_INT64)
+        reflection->SetInt64(message, field, column.getInt64());
+    else if constexpr (type == CppType::CPPTYPE_UINT32)
+        reflection->SetUInt32(message, field, static_cast<uint32_t>(column.getInt64()));
+    else if constexpr (type == CppType::CPPTYPE_UINT64)
+        reflection->SetUInt64(message, field, static_cast<uint64_t>(column.getInt64()));
+    else if constexpr (type == CppType::CPPTYPE_BOOL)
+        reflection->SetBool(message, field, column.getInt() != 0);
+    else if constexpr (type == CppType::CPPTYPE_DOUBLE)
+        reflection->SetDouble(message, field, column.getDouble());
+    else if constexpr (type == CppType::CPPTYPE_FLOAT)
+        reflection->SetFloat(message, field, static_cast<float>(column.getDouble()));
+    else if constexpr (type == CppType::CPPTYPE_ENUM)
+        reflection->SetEnumValue(message, field, column.getInt());
+}
+
+template<CppType type>
+void addElement(const SQLite::Column& column, google::protobuf::Message* message, const google::protobuf::FieldDescriptor* field)
+{
+    const auto* reflection = message->GetReflection();
+    if constexpr (type == CppType::CPPTYPE_STRING)
+        reflection->AddString(message, field, column.getString());
+    else if constexpr (type == CppType::CPPTYPE_INT32)
+        reflection->AddInt32(message, field, column.getInt());
+    else if constexpr (type == CppType::CPPTYPE_INT64)
+        reflection->AddInt64(message, field, column.getInt64());
+    else if constexpr (type == CppType::CPPTYPE_UINT32)
+        reflection->AddUInt32(message, field, static_cast<uint32_t>(column.getInt64()));
+    else if constexpr (type == CppType::CPPTYPE_UINT64)
+        reflection->AddUInt64(message, field, static_cast<uint64_t>(column.getInt64()));
+    else if constexpr (type == CppType::CPPTYPE_BOOL)
+        reflection->AddBool(message, field, column.getInt() != 0);
+    else if constexpr (type == CppType::CPPTYPE_DOUBLE)
+        reflection->AddDouble(message, field, column.getDouble());
+    else if constexpr (type == CppType::CPPTYPE_FLOAT)
+        reflection->AddFloat(message, field, static_cast<float>(column.getDouble()));
+    else if constexpr (type == CppType::CPPTYPE_ENUM)
+        reflection->AddEnumValue(message, field, column.getInt());
+}
+
+void bindSerialized(SQLite::Statement& query, int index, const google::protobuf::Message& message, const google::protobuf::FieldDescriptor*)
+{
+    const auto data = message.SerializeAsString();
+    query.bind(index, data.data(), static_cast<int>(data.size()));
+}
+
+void readSerialized(const SQLite::Column& column, google::protobuf::Message* message, const google::protobuf::FieldDescriptor*)
+{
+    if (!message->ParseFromArray(column.getBlob(), column.getBytes()))
+        throw std::runtime_error("couldn't parse stored data of " + message->GetTypeName());
+}
+
+template<template<CppType> typename Selector>
+auto selectFunction(const google::protobuf::FieldDescriptor* field) -> decltype(Selector<CppType::CPPTYPE_INT32>::function)
+{
+    switch (field->cpp_type())
+    {
+    case CppType::CPPTYPE_STRING:
+        return Selector<CppType::CPPTYPE_STRING>::function;
+    case CppType::CPPTYPE_INT32:
+        return Selector<CppType::CPPTYPE_INT32>::function;
+    case CppType::CPPTYPE_INT64:
+        return Selector<CppType::CPPTYPE_INT64>::function;
+    case CppType::CPPTYPE_UINT32:
+        return Selector<CppType::CPPTYPE_UINT32>::function;
+    case CppType::CPPTYPE_UINT64:
+        return Selector<CppType::CPPTYPE_UINT64>::function;
+    case CppType::CPPTYPE_BOOL:
+        return Selector<CppType::CPPTYPE_BOOL>::function;
+    case CppType::CPPTYPE_DOUBLE:
+        return Selector<CppType::CPPTYPE_DOUBLE>::function;
+    case CppType::CPPTYPE_FLOAT:
+        return Selector<CppType::CPPTYPE_FLOAT>::function;
+    case CppType::CPPTYPE_ENUM:
+        return Selector<CppType::CPPTYPE_ENUM>::function;
+    case CppType::CPPTYPE_MESSAGE:
+        return nullptr;
+    }
+    throw std::logic_error(std::string("Unsupported field type: ") + field->cpp_type_name());
+}
+
+struct AccessorRegistry
+{
+    std::mutex mutex;
+    std::map<std::pair<const google::protobuf::Descriptor*, int>, TablePlan::FieldAccessors> accessors;
+};
+
+// registration functions of generated files may be called during static initialization, so the registry is created on first use
+AccessorRegistry& getAccessorRegistry()
+{
+    static AccessorRegistry registry;
+    return registry;
+}
+
+template<CppType type>
+struct BindSelector
+{
+    static constexpr TablePlan::BindFunction function = &bindField<type>;
+};
+
+template<CppType type>
+struct BindElementSelector
+{
+    static constexpr TablePlan::BindElementFunction function = &bindElement<type>;
+};
+
+template<CppType type>
+struct ReadSelector
+{
+    static constexpr TablePlan::ReadFunction function = &readField<type>;
+};
+
+template<CppType type>
+struct AddSelector
+{
+    static constexpr TablePlan::ReadFunction function = &addElement<type>;
+};
+
+}
+
+const TablePlan::Column* TablePlan::findColumn(const google::protobuf::FieldDescriptor* field) const
+{
+    if (field->containing_type() != descriptor || fieldColumns[field->index()] < 0)
+        return nullptr;
+    return &columns[fieldColumns[field->index()]];
+}
+
+const std::vector<TablePlan::Column>& TablePlan::getLookupColumns() const
+{
+    return keyColumns.empty() ? columns : keyColumns;
+}
+
+std::string TablePlan::getInsertSql(size_t rows) const
+{
+    std::string res = insertRowsSql;
+    res.reserve(res.size() + rows * (rowValuesSql.size() + 1) + 14);
+    for (size_t i = 0; i < rows; ++i)
+    {
+        if (i > 0)
+            res += ',';
+        res += rowValuesSql;
+    }
+    res += " RETURNING id;";
+    return res;
+}
+
+void TablePlan::registerAccessors(const google::protobuf::Descriptor* descriptor, int number, const FieldAccessors& accessors)
+{
+    if (descriptor->file()->pool() != google::protobuf::DescriptorPool::generated_pool())
+        throw std::logic_error("accessors of type " + descriptor->full_name() + " out of generated pool");
+
+    auto& registry = getAccessorRegistry();
+    std::lock_guard lock(registry.mutex);
+    registry.accessors[{ descriptor, number }] = accessors;
+}
+
+const TablePlan::FieldAccessors* TablePlan::findAccessors(const google::protobuf::FieldDescriptor* field)
+{
+    // types with the same name from other pools have their own descriptors and are never found
+    auto& registry = getAccessorRegistry();
+    std::lock_guard lock(registry.mutex);
+    auto it = registry.accessors.find({ field->containing_type(), field->number() });
+    return it != registry.accessors.end() ? &it->second : nullptr;
+}
+
+std::string TablePlan::ChildTable::getSelectOwnersSql(size_t owners) const
+{
+    std::string res = selectOwnersSql;
+    res.reserve(res.size() + owners * 2 + selectOwnersOrderSql.size());
+    for (size_t i = 0; i < owners; ++i)
+        res += i > 0 ? ",?" : "?";
+    res += selectOwnersOrderSql;
+    return res;
+}
+
+std::string TablePlan::ChildTable::getInsertSql(size_t rows) const
+{
+    std::string res = insertRowsSql;
+    res.reserve(res.size() + rows * (rowValuesSql.size() + 1) + 1);
+    for (size_t i = 0; i < rows; ++i)
+    {
+        if (i > 0)
+            res += ',';
+        res += rowValuesSql;
+    }
+    res += ';';
+    return res;
+}
+
+TablePlan::BindFunction TablePlan::getBindFunction(const google::protobuf::FieldDescriptor* field)
+{
+    const auto* accessors = findAccessors(field);
+    if (accessors && accessors->bind)
+        return accessors->bind;
+    return selectFunction<BindSelector>(field);
+}
+
+TablePlan::BindElementFunction TablePlan::getBindElementFunction(const google::protobuf::FieldDescriptor* field)
+{
+    const auto* accessors = findAccessors(field);
+    if (accessors && accessors->bindElement)
+        return accessors->bindElement;
+    return selectFunction<BindElementSelector>(field);
+}
+
+TablePlan::ReadFunction TablePlan::getReadFunction(const google::protobuf::FieldDescriptor* field)
+{
+    const auto* accessors = findAccessors(field);
+    if (accessors && accessors->read)
+        return accessors->read;
+    return selectFunction<ReadSelector>(field);
+}
+
+TablePlan::ReadFunction TablePlan::getAddFunction(const google::protobuf::FieldDescriptor* field)
+{
+    const auto* accessors = findAccessors(field);
+    if (accessors && accessors->addElement)
+        return accessors->addElement;
+    return selectFunction<AddSelector>(field);
+}
+
+TablePlan::BindFunction TablePlan::getReflectionBindFunction(const google::protobuf::FieldDescriptor* field)
+{
+    return selectFunction<BindSelector>(field);
+}
+
+TablePlan::BindElementFunction TablePlan::getReflectionBindElementFunction(const google::protobuf::FieldDescriptor* field)
+{
+    return selectFunction<BindElementSelector>(field);
+}
+
+TablePlan::ReadFunction TablePlan::getReflectionReadFunction(const google::protobuf::FieldDescriptor* field)
+{
+    return selectFunction<ReadSelector>(field);
+}
+
+TablePlan::ReadFunction TablePlan::getReflectionAddFunction(const google::protobuf::FieldDescriptor* field)
+{
+    return selectFunction<AddSelector>(field);
+}
+
+TablePlan::BindFunction TablePlan::getSerializedBindFunction()
+{
+    return &bindSerialized;
+}
+
+TablePlan::ReadFunction TablePlan::getSerializedReadFunction()
+{
+    return &readSerialized;
+}
+
+}
@@ -0,0 +1,456 @@
+#include <ProtoDatabase/Database.h>
+
+#include "proto/messages.pb.h"
+#include "proto/messages.pb.cc"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+
+using namespace ProtoDatabase;
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct Settings
+{
+    std::vector<int> rows{ 1000, 100000, 1000000 };
+    int samples = 1000;
+    int elements = 10000;
+    bool memory = true;
+    bool disk = true;
+};
+
+/**
+ * @brief The Workload struct
+ *
+ * Operations over one message type, empty functions mean the operation isn't supported by the type
+ */
+struct Workload
+{
+    std::string name;
+    std::function<void(Database&)> createTable;
+    std::function<std::unique_ptr<google::protobuf::Message>(int)> makeMessage;
+    std::function<void(Database&, int)> findMessage;
+    std::function<void(Database&)> getAllMessages;
+    std::function<void(Database&)> getValue;
+    bool deletable = true;
+};
+
+class Report
+{
+public:
+    void print(const std::string& storage, const std::string& type, int rows, const std::string& operation, std::vector<Clock::duration>& samples, size_t itemsPerSample = 1)
+    {
+        if (samples.empty())
+            return;
+
+        std::sort(samples.begin(), samples.end());
+        Clock::duration total{};
+        for (auto sample : samples)
+            total += sample;
+
+        const double seconds = std::chrono::duration<double>(total).count();
+        const double opsPerSecond = seconds > 0 ? samples.size() * itemsPerSample / seconds : 0;
+
+        std::printf("%-7s %-22s %8d %-16s %7zu %14.0f %12.1f %12.1f\n",
+                    storage.c_str(), type.c_str(), rows, operation.c_str(), samples.size(), opsPerSecond,
+                    toMicroseconds(percentile(samples, 0.5)), toMicroseconds(percentile(samples, 0.99)));
+    }
+
+    static void printHeader()
+    {
+        std::printf("%-7s %-22s %8s %-16s %7s %14s %12s %12s\n", "storage", "type", "rows", "operation", "samples", "items/sec", "p50 us", "p99 us");
+    }
+
+private:
+    static Clock::duration percentile(const std::vector<Clock::duration>& samples, double rank)
+    {
+        size_t index = static_cast<size_t>(rank * (samples.size() - 1) + 0.5);
+        return samples[std::min(index, samples.size() - 1)];
+    }
+
+    static double toMicroseconds(Clock::duration duration)
+    {
+        return std::chrono::duration<double, std::micro>(duration).count();
+    }
+};
+
+template<typename Operation>
+std::vector<Clock::duration> measure(int count, Operation&& operation)
+{
+    std::vector<Clock::duration> samples;
+    samples.reserve(count);
+    for (int i = 0; i < count; ++i)
+    {
+        auto start = Clock::now();
+        operation(i);
+        samples.emplace_back(Clock::now() - start);
+    }
+    return samples;
+}
+
+std::string makeString(int seed, size_t length)
+{
+    static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+    std::string res(length, ' ');
+    uint32_t state = static_cast<uint32_t>(seed) * 2654435761u + 1;
+    for (auto& c : res)
+    {
+        state = state * 1664525u + 1013904223u;
+        c = alphabet[(state >> 16) % (sizeof(alphabet) - 1)];
+    }
+    return res;
+}
+
+template<typename Message>
+std::function<void(Database&)> createTableFunction()
+{
+    return [](Database& db) { db.createTable<Message>(); };
+}
+
+template<typename Message>
+std::function<void(Database&)> getAllFunction()
+{
+    return [](Database& db) { db.getAllMessages<Message>(); };
+}
+
+std::vector<Workload> getWorkloads()
+{
+    std::vector<Workload> res;
+
+    res.push_back({
+        "TestMessage",
+        createTableFunction<TestMessage>(),
+        [](int i) {
+            auto msg = std::make_unique<TestMessage>();
+            msg->set_value(i);
+            msg->set_stringvalue(makeString(i, 24));
+            msg->mutable_nestedmessage()->set_value(i);
+            msg->set_enumvalue(static_cast<TestMessage::TestEnum>(i % 4));
+            return msg;
+        },
+        nullptr,
+        getAllFunction<TestMessage>(),
+        [](Database& db) {
+            db.getValue<int32_t, TestMessage>(TestMessage::GetDescriptor()->FindFieldByNumber(TestMessage::kValueFieldNumber));
+        }
+    });
+
+    res.push_back({
+        "TestKeyMessage",
+        createTableFunction<TestKeyMessage>(),
+        [](int i) {
+            auto msg = std::make_unique<TestKeyMessage>();
+            msg->set_index(i);
+            msg->set_data(makeString(i, 24));
+            for (int j = 0; j < 4; ++j)
+                msg->add_numvalues(static_cast<int64_t>(i) * 4 + j);
+            return msg;
+        },
+        [](Database& db, int key) {
+            db.findMessage<TestKeyMessage>(TestKeyMessage::GetDescriptor()->FindFieldByNumber(TestKeyMessage::kIndexFieldNumber), key);
+        },
+        getAllFunction<TestKeyMessage>(),
+        [](Database& db) {
+            db.getValue<std::string, TestKeyMessage>(TestKeyMessage::GetDescriptor()->FindFieldByNumber(TestKeyMessage::kDataFieldNumber));
+        }
+    });
+
+    res.push_back({
+        "StringKeyMessage",
+        createTableFunction<StringKeyMessage>(),
+        [](int i) {
+            auto msg = std::make_unique<StringKeyMessage>();
+            msg->set_name("key" + std::to_string(i));
+            msg->set_number(i);
+            msg->set_floatnumber(i * 0.5f);
+            return msg;
+        },
+        [](Database& db, int key) {
+            db.findMessage<StringKeyMessage>(StringKeyMessage::GetDescriptor()->FindFieldByNumber(StringKeyMessage::kNameFieldNumber), "key" + std::to_string(key));
+        },
+        getAllFunction<StringKeyMessage>(),
+        [](Database& db) {
+            db.getValue<uint64_t, StringKeyMessage>(StringKeyMessage::GetDescriptor()->FindFieldByNumber(StringKeyMessage::kNumberFieldNumber));
+        }
+    });
+
+    res.push_back({
+        "TestRepeated",
+        createTableFunction<TestRepeated>(),
+        [](int i) {
+            auto msg = std::make_unique<TestRepeated>();
+            for (int j = 0; j < 4; ++j)
+            {
+                auto element = msg->add_msg();
+                element->set_strvalue(makeString(i * 4 + j, 12));
+                element->set_intvalue(i * 4 + j);
+            }
+            return msg;
+        },
+        nullptr,
+        getAllFunction<TestRepeated>(),
+        nullptr,
+        false
+    });
+
+    res.push_back({
+        "TestMap",
+        createTableFunction<TestMap>(),
+        [](int i) {
+            auto msg = std::make_unique<TestMap>();
+            for (int j = 0; j < 4; ++j)
+                (*msg->mutable_data())[makeString(i * 4 + j, 8)] = j;
+            return msg;
+        },
+        nullptr,
+        getAllFunction<TestMap>(),
+        nullptr,
+        false
+    });
+
+    res.push_back({
+        "ComplexKeyTestMessage",
+        createTableFunction<ComplexKeyTestMessage>(),
+        [](int i) {
+            auto msg = std::make_unique<ComplexKeyTestMessage>();
+            msg->mutable_pos()->set_x(i);
+            msg->mutable_pos()->set_y(-i);
+            msg->set_data(makeString(i, 24));
+            msg->add_numvalues(i);
+            msg->set_enumvalue(static_cast<ComplexKeyTestMessage::TestEnum>(i % 4));
+            return msg;
+        },
+        [](Database& db, int key) {
+            ComplexKeyTestMessage::Position pos;
+            pos.set_x(key);
+            pos.set_y(-key);
+            db.findMessage<ComplexKeyTestMessage>(ComplexKeyTestMessage::GetDescriptor()->FindFieldByNumber(ComplexKeyTestMessage::kPosFieldNumber), pos);
+        },
+        getAllFunction<ComplexKeyTestMessage>(),
+        nullptr
+    });
+
+    res.push_back({
+        "ComplexMessage",
+        createTableFunction<ComplexMessage>(),
+        [](int i) {
+            auto msg = std::make_unique<ComplexMessage>();
+            for (int j = 0; j < 2; ++j)
+            {
+                auto nested = msg->add_msg();
+                nested->set_name(makeString(i * 2 + j, 12));
+                nested->add_value(j);
+                auto& entry = (*msg->mutable_messagemap())[makeString(i * 2 + j, 8)];
+                entry.set_value(i);
+                entry.add_str(makeString(i + j, 6));
+            }
+            msg->add_values(i);
+            msg->set_str(makeString(i, 16));
+            msg->set_numvalue(i);
+            return msg;
+        },
+        nullptr,
+        getAllFunction<ComplexMessage>(),
+        [](Database& db) {
+            db.getValue<int32_t, ComplexMessage>(ComplexMessage::GetDescriptor()->FindFieldByNumber(ComplexMessage::kNumValueFieldNumber));
+        }
+    });
+
+    return res;
+}
+
+void run(const Workload& workload, const std::string& storage, const std::string& path, int rows, int samples, Report& report)
+{
+    Database db(path);
+    workload.createTable(db);
+
+    // table is filled in batches, then single operations are measured at this size
+    std::vector<Clock::duration> fill;
+    const int batchSize = 1000;
+    for (int begin = 0; begin < rows; begin += batchSize)
+    {
+        std::vector<std::unique_ptr<google::protobuf::Message>> batch;
+        std::vector<const google::protobuf::Message*> pointers;
+        for (int i = begin; i < std::min(rows, begin + batchSize); ++i)
+        {
+            batch.emplace_back(workload.makeMessage(i));
+            pointers.emplace_back(batch.back().get());
+        }
+
+        auto start = Clock::now();
+        db.insertMessages(pointers);
+        fill.emplace_back(Clock::now() - start);
+    }
+    report.print(storage, workload.name, rows, "insertMessages", fill, batchSize);
+
+    std::vector<std::unique_ptr<google::protobuf::Message>> inserted;
+    for (int i = 0; i < samples; ++i)
+        inserted.emplace_back(workload.makeMessage(rows + i));
+
+    auto insertSamples = measure(samples, [&](int i) { db.insertMessage(*inserted[i]); });
+    report.print(storage, workload.name, rows, "insertMessage", insertSamples);
+
+    std::vector<std::unique_ptr<google::protobuf::Message>> updated;
+    for (int i = 0; i < samples; ++i)
+        updated.emplace_back(workload.makeMessage((i * 7919) % rows));
+
+    auto writeSamples = measure(samples, [&](int i) { db.writeMessage(*updated[i]); });
+    report.print(storage, workload.name, rows, "writeMessage", writeSamples);
+
+    if (workload.findMessage)
+    {
+        auto findSamples = measure(samples, [&](int i) { workload.findMessage(db, (i * 7919) % rows); });
+        report.print(storage, workload.name, rows, "findMessage", findSamples);
+    }
+
+    const int scans = std::max(1, std::min(samples, 100000 / std::max(rows, 1)));
+    auto getAllSamples = measure(scans, [&](int) { workload.getAllMessages(db); });
+    report.print(storage, workload.name, rows, "getAllMessages", getAllSamples, rows);
+
+    if (workload.getValue)
+    {
+        auto getValueSamples = measure(scans, [&](int) { workload.getValue(db); });
+        report.print(storage, workload.name, rows, "getValue", getValueSamples, rows);
+    }
+
+    if (workload.deletable)
+    {
+        auto deleteSamples = measure(samples, [&](int i) { db.deleteMessage(*inserted[i]); });
+        report.print(storage, workload.name, rows, "deleteMessage", deleteSamples);
+    }
+}
+
+// rows changed by writeMessage of a message with a large repeated field, it shows how much of stored children is rewritten
+void runWriteAmplification(const std::string& storage, const std::string& path, int elements, int samples)
+{
+    DatabaseOptions options;
+    options.collectStats = true;
+    Database db(path, options);
+    db.createTable<TestKeyMessage>();
+
+    TestKeyMessage msg;
+    msg.set_index(0);
+    msg.set_data(makeString(0, 24));
+    for (int i = 0; i < elements; ++i)
+        msg.add_numvalues(i);
+    db.writeMessage(msg);
+
+    const std::vector<std::pair<std::string, std::function<void(int)>>> changes{
+        { "scalar", [&msg](int i) { msg.set_data(makeString(i, 24)); } },
+        { "append", [&msg, elements](int i) { msg.add_numvalues(static_cast<int64_t>(elements) + i); } },
+        { "last element", [&msg](int i) { msg.set_numvalues(msg.numvalues_size() - 1, -i); } },
+        { "first element", [&msg, elements](int i) { msg.set_numvalues(0, -static_cast<int64_t>(elements) - i); } }
+    };
+
+    for (const auto& [name, change] : changes)
+    {
+        db.resetStats();
+        auto writeSamples = measure(samples, [&](int i) {
+            change(i + 1);
+            db.writeMessage(msg);
+        });
+        std::sort(writeSamples.begin(), writeSamples.end());
+
+        std::printf("%-7s %8d %-14s %7d %12.1f %12.1f\n", storage.c_str(), elements, name.c_str(), samples,
+                    static_cast<double>(db.getStats().rowsWritten) / samples,
+                    std::chrono::duration<double, std::micro>(writeSamples[writeSamples.size() / 2]).count());
+    }
+}
+
+std::vector<int> parseList(const std::string& value)
+{
+    std::vector<int> res;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        res.emplace_back(std::stoi(item));
+    return res;
+}
+
+void printUsage()
+{
+    std::cout << "usage: ProtoDatabase-bench [--rows N[,N...]] [--samples N] [--elements N] [--storage memory|disk|all]\n";
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Settings settings;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--rows" && i + 1 < argc)
+        {
+            settings.rows = parseList(argv[++i]);
+        }
+        else if (arg == "--samples" && i + 1 < argc)
+        {
+            settings.samples = std::stoi(argv[++i]);
+        }
+        else if (arg == "--elements" && i + 1 < argc)
+        {
+            settings.elements = std::stoi(argv[++i]);
+        }
+        else if (arg == "--storage" && i + 1 < argc)
+        {
+            std::string storage = argv[++i];
+            settings.memory = storage == "memory" || storage == "all";
+            settings.disk = storage == "disk" || storage == "all";
+        }
+        else
+        {
+            printUsage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    const auto diskPath = (std::filesystem::temp_directory_path() / "ProtoDatabase-bench.db").string();
+    auto removeDatabase = [&diskPath]() {
+        for (const auto& suffix : { "", "-journal", "-wal", "-shm" })
+            std::filesystem::remove(diskPath + suffix);
+    };
+
+    Report report;
+    Report::printHeader();
+    for (const auto& workload : getWorkloads())
+    {
+        for (int rows : settings.rows)
+        {
+            if (settings.memory)
+                run(workload, "memory", ":memory:", rows, settings.samples, report);
+
+            if (settings.disk)
+            {
+                removeDatabase();
+                run(workload, "disk", diskPath, rows, settings.samples, report);
+                removeDatabase();
+            }
+        }
+    }
+
+    std::printf("\n%-7s %8s %-14s %7s %12s %12s\n", "storage", "elements", "change", "samples", "rows/write", "p50 us");
+    const int writes = std::min(settings.samples, 100);
+    if (settings.memory)
+        runWriteAmplification("memory", ":memory:", settings.elements, writes);
+
+    if (settings.disk)
+    {
+        removeDatabase();
+        runWriteAmplification("disk", diskPath, settings.elements, writes);
+        removeDatabase();
+    }
+
+    return 0;
+}
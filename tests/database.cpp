@@ -1,9 +1,19 @@
 #include <catch2/catch_all.hpp>
 
 #include <ProtoDatabase/Database.h>
+#include <ProtoDatabase/DatabasePool.h>
 
+#include <google/protobuf/dynamic_message.h>
 #include <google/protobuf/util/message_differencer.h>
 
+#include <atomic>
+#include <filesystem>
+#include <limits>
+#include <thread>
+
+#include <tests/proto/storage.pb.h>
+#include <tests/proto/storage.pdb.h>
+
 #include "proto/messages.pb.h"
 #include "proto/messages.pb.cc"
 
@@ -746,3 +756,1863 @@ TEST_CASE("Data selection test", "[smoketest]") {
         REQUIRE(res == names);
     }
 }
+
+TEST_CASE("Statement cache test", "[smoketest]") {
+    Database db;
+
+    srand(0);
+
+    REQUIRE_NOTHROW(db.createTable<TestKeyMessage>());
+
+    auto writeMessages = [&db](int first, int count) {
+        for (int i = first; i < first + count; ++i)
+        {
+            TestKeyMessage msg;
+            msg.set_index(i);
+            msg.mutable_numvalues()->Add(rand());
+            msg.set_data(generate_random_string(10));
+            REQUIRE_NOTHROW(db.writeMessage(msg));
+        }
+    };
+
+    writeMessages(0, 5);
+    auto warmStats = db.getStatementCacheStats();
+    REQUIRE(warmStats.size > 0);
+
+    writeMessages(5, 5);
+    auto stats = db.getStatementCacheStats();
+    REQUIRE(stats.misses == warmStats.misses);
+    REQUIRE(stats.hits > warmStats.hits);
+
+    auto field = TestKeyMessage::GetDescriptor()->FindFieldByNumber(TestKeyMessage::kIndexFieldNumber);
+    for (int i = 0; i < 10; ++i)
+    {
+        auto msg = db.findMessage<TestKeyMessage, int>(field, i);
+        REQUIRE(msg.has_value());
+        REQUIRE(msg->index() == i);
+    }
+
+    REQUIRE_NOTHROW(db.setStatementCacheCapacity(0));
+    REQUIRE(db.getStatementCacheStats().size == 0);
+    writeMessages(10, 2);
+    REQUIRE(db.getAllMessages<TestKeyMessage>().size() == 12);
+    REQUIRE(db.getStatementCacheStats().size == 0);
+}
+
+TEST_CASE("Unsigned field test", "[smoketest]") {
+    Database db;
+
+    /*
+        message StringKeyMessage {
+            string name = 1 [(ProtoDatabase.Proto.objectKeyField) = true];
+            uint64 number = 2;
+            float floatNumber = 3;
+        }
+     */
+
+    REQUIRE_NOTHROW(db.createTable<StringKeyMessage>());
+
+    const uint64_t bigNumber = 0xFFFFFFFFFFFFFFF0ull;
+
+    StringKeyMessage msg;
+    msg.set_name("unsigned");
+    msg.set_number(bigNumber);
+    msg.set_floatnumber(1.5f);
+    REQUIRE_NOTHROW(db.writeMessage(msg));
+
+    std::optional<StringKeyMessage> res;
+    REQUIRE_NOTHROW(res = db.findMessage<StringKeyMessage, std::string>(StringKeyMessage::GetDescriptor()->FindFieldByNumber(StringKeyMessage::kNameFieldNumber), msg.name()));
+    REQUIRE(res.has_value());
+    REQUIRE(res->number() == bigNumber);
+    REQUIRE_NOTHROW(EqualMessages(*res, msg));
+}
+
+TEST_CASE("Batch write test", "[smoketest]") {
+    Database db;
+
+    srand(0);
+
+    REQUIRE_NOTHROW(db.createTable<TestKeyMessage>());
+
+    std::vector<TestKeyMessage> msgList;
+    for (int i = 0; i < 5000; ++i)
+    {
+        TestKeyMessage msg;
+        msg.set_index(i);
+        for (int j = 0; j < (rand() % 3); ++j)
+            msg.mutable_numvalues()->Add(rand());
+        msg.set_data(generate_random_string(10));
+        msgList.emplace_back(std::move(msg));
+    }
+
+    std::vector<int64_t> ids;
+    REQUIRE_NOTHROW(ids = db.insertMessages(msgList));
+    REQUIRE(ids.size() == msgList.size());
+
+    std::vector<TestKeyMessage> res;
+    REQUIRE_NOTHROW(res = db.getAllMessages<TestKeyMessage>());
+    REQUIRE(res.size() == msgList.size());
+    for (size_t i = 0; i < res.size(); ++i)
+        REQUIRE_NOTHROW(EqualMessages(res[i], msgList[i]));
+
+    std::vector<const google::protobuf::Message*> updates;
+    for (size_t i = 0; i < msgList.size(); i += 100)
+    {
+        msgList[i].set_data(generate_random_string(12));
+        msgList[i].mutable_numvalues()->Add(rand());
+        updates.emplace_back(&msgList[i]);
+    }
+
+    std::vector<int64_t> updatedIds;
+    REQUIRE_NOTHROW(updatedIds = db.writeMessages(updates));
+    REQUIRE(updatedIds.size() == updates.size());
+    for (size_t i = 0; i < updatedIds.size(); ++i)
+        REQUIRE(updatedIds[i] == ids[i * 100]);
+
+    auto field = TestKeyMessage::GetDescriptor()->FindFieldByNumber(TestKeyMessage::kIndexFieldNumber);
+    for (size_t i = 0; i < msgList.size(); i += 100)
+    {
+        auto msg = db.findMessage<TestKeyMessage, int>(field, msgList[i].index());
+        REQUIRE(msg.has_value());
+        REQUIRE_NOTHROW(EqualMessages(*msg, msgList[i]));
+    }
+
+    REQUIRE(db.getAllMessages<TestKeyMessage>().size() == msgList.size());
+
+    std::vector<TestKeyMessage> duplicates(2);
+    duplicates[0].set_index(100000);
+    duplicates[1].set_index(0);
+    REQUIRE_THROWS(db.insertMessages(duplicates));
+    REQUIRE(!db.findMessage<TestKeyMessage, int>(field, 100000));
+}
+
+TEST_CASE("Batch write with trigger test", "[smoketest]") {
+    const auto path = (std::filesystem::temp_directory_path() / "ProtoDatabase-batch-trigger-test.db").string();
+    std::filesystem::remove(path);
+
+    {
+        Database db(path);
+        REQUIRE_NOTHROW(db.createTable<TestKeyMessage>());
+    }
+
+    // rows inserted by the trigger take IDs between rows of the batch
+    {
+        SQLite::Database raw(path, SQLite::OPEN_READWRITE);
+        raw.exec("CREATE TRIGGER shadow AFTER INSERT ON TestKeyMessage WHEN NEW.field_index < 1000 BEGIN "
+                 "INSERT INTO TestKeyMessage(field_index, field_data) VALUES (NEW.field_index + 1000, 'shadow'); END;");
+    }
+
+    Database db(path);
+    REQUIRE_NOTHROW(db.createTable<TestKeyMessage>());
+
+    std::vector<TestKeyMessage> msgList;
+    for (int i = 0; i < 37; ++i)
+    {
+        TestKeyMessage msg;
+        msg.set_index(i);
+        msg.add_numvalues(i * 10);
+        msg.set_data("data" + std::to_string(i));
+        msgList.emplace_back(std::move(msg));
+    }
+
+    std::vector<int64_t> ids;
+    REQUIRE_NOTHROW(ids = db.insertMessages(msgList));
+    REQUIRE(ids.size() == msgList.size());
+
+    {
+        SQLite::Database raw(path, SQLite::OPEN_READONLY);
+        SQLite::Statement query(raw, "SELECT field_index FROM TestKeyMessage WHERE id=?;");
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            query.bind(1, ids[i]);
+            REQUIRE(query.executeStep());
+            REQUIRE(query.getColumn(0).getInt() == msgList[i].index());
+            query.reset();
+        }
+    }
+
+    auto field = TestKeyMessage::GetDescriptor()->FindFieldByNumber(TestKeyMessage::kIndexFieldNumber);
+    for (const auto& msg : msgList)
+    {
+        auto found = db.findMessage<TestKeyMessage, int>(field, msg.index());
+        REQUIRE(found.has_value());
+        REQUIRE_NOTHROW(EqualMessages(*found, msg));
+    }
+}
+
+TEST_CASE("Repeated field read test", "[smoketest]") {
+    Database db;
+
+    REQUIRE_NOTHROW(db.createTable<TestKeyMessage>());
+    REQUIRE_NOTHROW(db.createTable<TestRepeated>());
+
+    TestKeyMessage msg;
+    msg.set_index(1);
+    for (int i = 0; i < 1000; ++i)
+        msg.mutable_numvalues()->Add(i * 3);
+    REQUIRE_NOTHROW(db.writeMessage(msg));
+
+    TestRepeated repeated;
+    for (int i = 0; i < 500; ++i)
+    {
+        auto element = repeated.mutable_msg()->Add();
+        element->set_intvalue(i);
+        element->set_strvalue(std::to_string(i));
+    }
+    REQUIRE_NOTHROW(db.writeMessage(repeated));
+
+    auto countStatements = [&db]() {
+        auto stats = db.getStatementCacheStats();
+        return stats.hits + stats.misses;
+    };
+
+    auto before = countStatements();
+    auto res = db.findMessage<TestKeyMessage, int>(TestKeyMessage::GetDescriptor()->FindFieldByNumber(TestKeyMessage::kIndexFieldNumber), 1);
+    REQUIRE(countStatements() - before == 2);
+    REQUIRE(res.has_value());
+    REQUIRE_NOTHROW(EqualMessages(*res, msg));
+
+    before = countStatements();
+    auto repeatedRes = db.getAllMessages<TestRepeated>();
+    REQUIRE(countStatements() - before == 2);
+    REQUIRE(repeatedRes.size() == 1);
+    REQUIRE_NOTHROW(EqualMessages(repeatedRes[0], repeated));
+}
+
+TEST_CASE("Message cursor test", "[smoketest]") {
+    Database db;
+
+    srand(0);
+
+    REQUIRE_NOTHROW(db.createTable<TestKeyMessage>());
+
+    std::vector<TestKeyMessage> msgList;
+    for (int i = 0; i < 100; ++i)
+    {
+        TestKeyMessage msg;
+        msg.set_index(i);
+        for (int j = 0; j < (rand() % 5) + 1; ++j)
+            msg.mutable_numvalues()->Add(rand());
+        msg.set_data(generate_random_string(10));
+        msgList.emplace_back(std::move(msg));
+    }
+    REQUIRE_NOTHROW(db.insertMessages(msgList));
+
+    {
+        size_t i = 0;
+        for (const auto& msg : db.getMessageCursor<TestKeyMessage>())
+        {
+            REQUIRE(i < msgList.size());
+            REQUIRE_NOTHROW(EqualMessages(msg, msgList[i]));
+            ++i;
+        }
+        REQUIRE(i == msgList.size());
+    }
+
+    {
+        TestKeyMessage reused;
+        auto cursor = db.getMessageCursor<TestKeyMessage>(&reused);
+        size_t i = 0;
+        while (cursor.next())
+        {
+            REQUIRE(&cursor.current() == &reused);
+            REQUIRE_NOTHROW(EqualMessages(reused, msgList[i]));
+            ++i;
+        }
+        REQUIRE(i == msgList.size());
+    }
+
+    {
+        REQUIRE_NOTHROW(db.clearTable<TestKeyMessage>());
+        auto cursor = db.getMessageCursor<TestKeyMessage>();
+        REQUIRE(cursor.begin() == cursor.end());
+    }
+}
+
+TEST_CASE("Message scan test", "[smoketest]") {
+    Database db;
+
+    srand(0);
+
+    REQUIRE_NOTHROW(db.createTable<ComplexMessage>());
+
+    std::vector<ComplexMessage> messages;
+    for (int i = 0; i < 20; ++i)
+    {
+        ComplexMessage msg;
+        for (int j = 0; j < (rand() % 5) + 1; ++j)
+        {
+            ComplexMessage::NestedMessage nested;
+            nested.set_name(generate_random_string((rand() % 20) + 1));
+            nested.add_value(rand());
+            msg.mutable_msg()->Add(std::move(nested));
+        }
+        msg.mutable_values()->Add(rand());
+        msg.mutable_messagemap()->emplace(generate_random_string(5), ComplexMessage::MapMessage{});
+        msg.set_str(generate_random_string(10));
+        msg.set_numvalue(i);
+        messages.emplace_back(std::move(msg));
+    }
+    REQUIRE_NOTHROW(db.writeMessages(messages));
+
+    ComplexMessage reused;
+    size_t count = 0;
+    REQUIRE_NOTHROW(db.forEachMessage<ComplexMessage>([&](const ComplexMessage& msg) {
+        REQUIRE(&msg == &reused);
+        REQUIRE_NOTHROW(EqualMessages(msg, messages[count]));
+        ++count;
+    }, &reused));
+    REQUIRE(count == messages.size());
+
+    count = 0;
+    REQUIRE_NOTHROW(db.forEachMessage<ComplexMessage>([&](const ComplexMessage& msg) {
+        ++count;
+        return msg.numvalue() < 4;
+    }));
+    REQUIRE(count == 5);
+}
+
+TEST_CASE("Arena read test", "[smoketest]") {
+    Database db;
+
+    srand(0);
+
+    REQUIRE_NOTHROW(db.createTable<ComplexKeyTestMessage>());
+
+    std::vector<ComplexKeyTestMessage> msgList;
+    for (int i = 0; i < 5; ++i)
+    {
+        ComplexKeyTestMessage msg;
+        msg.mutable_pos()->set_x(i);
+        msg.mutable_pos()->set_y(i * 2);
+        msg.set_data(generate_random_string(30));
+        for (int j = 0; j < 5; ++j)
+            msg.mutable_numvalues()->Add(rand());
+        REQUIRE_NOTHROW(db.writeMessage(msg));
+        msgList.emplace_back(std::move(msg));
+    }
+
+    google::protobuf::Arena arena;
+
+    std::vector<ComplexKeyTestMessage*> res;
+    REQUIRE_NOTHROW(res = db.getAllMessages<ComplexKeyTestMessage>(&arena));
+    REQUIRE(res.size() == msgList.size());
+    for (size_t i = 0; i < res.size(); ++i)
+    {
+        REQUIRE(res[i]->GetArena() == &arena);
+        REQUIRE(res[i]->pos().GetArena() == &arena);
+        REQUIRE_NOTHROW(EqualMessages(*res[i], msgList[i]));
+    }
+
+    auto field = ComplexKeyTestMessage::GetDescriptor()->FindFieldByNumber(ComplexKeyTestMessage::kPosFieldNumber);
+    ComplexKeyTestMessage* msg = nullptr;
+    REQUIRE_NOTHROW(msg = db.findMessage<ComplexKeyTestMessage>(field, msgList[3].pos(), &arena));
+    REQUIRE(msg);
+    REQUIRE(msg->GetArena() == &arena);
+    REQUIRE_NOTHROW(EqualMessages(*msg, msgList[3]));
+
+    ComplexKeyTestMessage::Position fakePos;
+    fakePos.set_x(100);
+    REQUIRE(db.findMessage<ComplexKeyTestMessage>(field, fakePos, &arena) == nullptr);
+    REQUIRE_THROWS(db.getAllMessages<ComplexKeyTestMessage>(nullptr));
+}
+
+TEST_CASE("Transaction test", "[smoketest]") {
+    Database db;
+
+    REQUIRE_NOTHROW(db.createTable<TestKeyMessage>());
+
+    TestKeyMessage msg;
+    msg.set_index(1);
+    msg.set_data(generate_random_string(20));
+
+    {
+        auto transaction = db.beginBatch();
+        REQUIRE_NOTHROW(db.writeMessage(msg));
+
+        {
+            Database::Transaction nested(db);
+            msg.set_index(2);
+            REQUIRE_NOTHROW(db.writeMessage(msg));
+            REQUIRE(db.getAllMessages<TestKeyMessage>().size() == 2);
+            REQUIRE_NOTHROW(nested.rollback());
+        }
+        REQUIRE(db.getAllMessages<TestKeyMessage>().size() == 1);
+
+        {
+            Database::Transaction nested(db);
+            msg.set_index(3);
+            REQUIRE_NOTHROW(db.writeMessage(msg));
+            REQUIRE_NOTHROW(nested.commit());
+        }
+        REQUIRE_NOTHROW(transaction.commit());
+        REQUIRE_THROWS(transaction.commit());
+    }
+    REQUIRE(db.getAllMessages<TestKeyMessage>().size() == 2);
+
+    {
+        auto transaction = db.beginBatch();
+        for (int i = 10; i < 20; ++i)
+        {
+            msg.set_index(i);
+            REQUIRE_NOTHROW(db.insertMessage(msg));
+        }
+    }
+    REQUIRE(db.getAllMessages<TestKeyMessage>().size() == 2);
+
+    {
+        auto transaction = db.beginBatch();
+        msg.set_index(3);
+        REQUIRE_THROWS(db.insertMessage(msg));
+        msg.set_index(4);
+        REQUIRE_NOTHROW(db.insertMessage(msg));
+        REQUIRE_NOTHROW(transaction.commit());
+    }
+    REQUIRE(db.getAllMessages<TestKeyMessage>().size() == 3);
+}
+
+TEST_CASE("Database options test", "[smoketest]") {
+    const auto path = (std::filesystem::temp_directory_path() / "ProtoDatabase-options-test.db").string();
+    std::filesystem::remove(path);
+
+    DatabaseOptions options;
+    options.journalMode = DatabaseOptions::JournalMode::Wal;
+    options.synchronous = DatabaseOptions::Synchronous::Normal;
+    options.tempStore = DatabaseOptions::TempStore::Memory;
+    options.cacheSize = -8192;
+    options.mmapSize = 1 << 24;
+    options.pageSize = 8192;
+    options.busyTimeout = std::chrono::milliseconds(1000);
+
+    {
+        Database db(path, options);
+        REQUIRE_NOTHROW(db.createTable<TestKeyMessage>());
+
+        TestKeyMessage msg;
+        msg.set_index(1);
+        msg.set_data(generate_random_string(20));
+        REQUIRE_NOTHROW(db.writeMessage(msg));
+    }
+
+    {
+        SQLite::Database raw(path, SQLite::OPEN_READONLY);
+        REQUIRE(raw.execAndGet("PRAGMA journal_mode;").getString() == "wal");
+        REQUIRE(raw.execAndGet("PRAGMA page_size;").getInt() == 8192);
+    }
+
+    {
+        Database db(path);
+        REQUIRE(db.getAllMessages<TestKeyMessage>().size() == 1);
+    }
+
+    std::filesystem::remove(path);
+    std::filesystem::remove(path + "-wal");
+    std::filesystem::remove(path + "-shm");
+}
+
+TEST_CASE("Database pool test", "[smoketest]") {
+    const auto path = (std::filesystem::temp_directory_path() / "ProtoDatabase-pool-test.db").string();
+    std::filesystem::remove(path);
+
+    {
+        REQUIRE_THROWS(DatabasePool(":memory:", 2));
+
+        DatabasePool pool(path, 4);
+        REQUIRE_NOTHROW(pool.createTable<TestKeyMessage>());
+
+        std::vector<TestKeyMessage> msgList;
+        for (int i = 0; i < 50; ++i)
+        {
+            TestKeyMessage msg;
+            msg.set_index(i);
+            msg.set_data(generate_random_string(20));
+            msg.mutable_numvalues()->Add(i);
+            msgList.emplace_back(std::move(msg));
+        }
+        REQUIRE_NOTHROW(pool.writeMessages(msgList));
+
+        auto field = TestKeyMessage::GetDescriptor()->FindFieldByNumber(TestKeyMessage::kIndexFieldNumber);
+
+        std::atomic<int> mismatches = 0;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 8; ++t)
+        {
+            threads.emplace_back([&]() {
+                try
+                {
+                    for (const auto& expected : msgList)
+                    {
+                        auto msg = pool.findMessage<TestKeyMessage>(field, expected.index());
+                        if (!msg || !google::protobuf::util::MessageDifferencer::Equals(msg.value(), expected))
+                            ++mismatches;
+                    }
+                    // the concurrent insert is either seen completely or not at all
+                    const auto all = pool.getAllMessages<TestKeyMessage>();
+                    if (all.size() != msgList.size() && all.size() != msgList.size() + 1)
+                        ++mismatches;
+                    for (size_t i = 0; i < all.size(); ++i)
+                    {
+                        const bool isExpected = i < msgList.size() ? google::protobuf::util::MessageDifferencer::Equals(all[i], msgList[i]) : all[i].index() == 100;
+                        if (!isExpected)
+                            ++mismatches;
+                    }
+                }
+                catch (...)
+                {
+                    ++mismatches;
+                }
+            });
+        }
+
+        TestKeyMessage extra;
+        extra.set_index(100);
+        REQUIRE_NOTHROW(pool.insertMessage(extra));
+
+        for (auto& thread : threads)
+            thread.join();
+        REQUIRE(mismatches == 0);
+
+        REQUIRE(pool.findMessage<TestKeyMessage>(field, 100).has_value());
+        REQUIRE(pool.getValue<int32_t, TestKeyMessage>(field).size() == msgList.size() + 1);
+
+        {
+            auto writer = pool.acquireWriter();
+            auto transaction = writer->beginBatch();
+            REQUIRE_NOTHROW(writer->deleteMessage<TestKeyMessage>(field, 100));
+            REQUIRE_NOTHROW(transaction.commit());
+        }
+        REQUIRE_FALSE(pool.findMessage<TestKeyMessage>(field, 100).has_value());
+    }
+
+    std::filesystem::remove(path);
+    std::filesystem::remove(path + "-wal");
+    std::filesystem::remove(path + "-shm");
+}
+
+TEST_CASE("Blob storage test", "[smoketest]") {
+    Database db;
+
+    REQUIRE_NOTHROW(db.createTable<BlobMessage>());
+    REQUIRE(db.getTableCount() == 1);
+
+    std::vector<BlobMessage> msgList;
+    for (int i = 0; i < 10; ++i)
+    {
+        BlobMessage msg;
+        msg.set_name(generate_random_string(10) + std::to_string(i));
+        msg.set_weight(i * 0.5);
+        for (int j = 0; j < 3; ++j)
+        {
+            auto item = msg.add_items();
+            item->set_title(generate_random_string(15));
+            item->add_values(j);
+            item->add_values(-j);
+            (*msg.mutable_counters())[generate_random_string(5)] = i * j;
+        }
+        msgList.emplace_back(std::move(msg));
+    }
+    REQUIRE_NOTHROW(db.insertMessages(msgList));
+
+    auto res = db.getAllMessages<BlobMessage>();
+    REQUIRE(res.size() == msgList.size());
+    for (size_t i = 0; i < res.size(); ++i)
+        REQUIRE(google::protobuf::util::MessageDifferencer::Equals(res[i], msgList[i]));
+
+    auto nameField = BlobMessage::GetDescriptor()->FindFieldByNumber(BlobMessage::kNameFieldNumber);
+    auto weightField = BlobMessage::GetDescriptor()->FindFieldByNumber(BlobMessage::kWeightFieldNumber);
+
+    msgList[4].set_weight(100.0);
+    msgList[4].mutable_items()->RemoveLast();
+    REQUIRE_NOTHROW(db.writeMessage(msgList[4]));
+
+    auto msg = db.findMessage<BlobMessage>(nameField, msgList[4].name());
+    REQUIRE(msg.has_value());
+    REQUIRE(google::protobuf::util::MessageDifferencer::Equals(msg.value(), msgList[4]));
+
+    REQUIRE(db.getValue<std::string, BlobMessage>(nameField).size() == msgList.size());
+    REQUIRE_THROWS(db.getValue<double, BlobMessage>(weightField));
+
+    REQUIRE_NOTHROW(db.deleteMessage<BlobMessage>(nameField, msgList[4].name()));
+    REQUIRE_FALSE(db.findMessage<BlobMessage>(nameField, msgList[4].name()).has_value());
+    REQUIRE(db.getAllMessages<BlobMessage>().size() == msgList.size() - 1);
+
+    REQUIRE_NOTHROW(db.createTable<BlobNoKeyMessage>());
+
+    BlobNoKeyMessage noKey;
+    noKey.set_value(7);
+    noKey.add_tags("first");
+    noKey.add_tags("second");
+    REQUIRE_NOTHROW(db.insertMessage(noKey));
+    REQUIRE_NOTHROW(db.insertMessage(BlobNoKeyMessage{}));
+
+    auto noKeyList = db.getAllMessages<BlobNoKeyMessage>();
+    REQUIRE(noKeyList.size() == 2);
+    REQUIRE(google::protobuf::util::MessageDifferencer::Equals(noKeyList[0], noKey));
+    REQUIRE(google::protobuf::util::MessageDifferencer::Equals(noKeyList[1], BlobNoKeyMessage{}));
+
+    REQUIRE_NOTHROW(db.deleteMessage(noKey));
+    REQUIRE(db.getAllMessages<BlobNoKeyMessage>().size() == 1);
+}
+
+TEST_CASE("Secondary index test", "[smoketest]") {
+    const auto path = (std::filesystem::temp_directory_path() / "ProtoDatabase-index-test.db").string();
+    std::filesystem::remove(path);
+
+    {
+        Database db(path);
+
+        REQUIRE_NOTHROW(db.createTable<IndexedMessage>());
+        REQUIRE_NOTHROW(db.createTable<IndexedBlobMessage>());
+
+        std::vector<IndexedMessage> msgList;
+        for (int i = 0; i < 20; ++i)
+        {
+            IndexedMessage msg;
+            msg.set_id(i);
+            msg.set_category(i % 2 == 0 ? "even" : "odd");
+            msg.set_owner("owner" + std::to_string(i % 3));
+            msg.set_score(i);
+            msgList.emplace_back(std::move(msg));
+        }
+        REQUIRE_NOTHROW(db.insertMessages(msgList));
+
+        auto ownerField = IndexedMessage::GetDescriptor()->FindFieldByNumber(IndexedMessage::kOwnerFieldNumber);
+        auto categoryField = IndexedMessage::GetDescriptor()->FindFieldByNumber(IndexedMessage::kCategoryFieldNumber);
+        auto scoreField = IndexedMessage::GetDescriptor()->FindFieldByNumber(IndexedMessage::kScoreFieldNumber);
+
+        auto owned = db.findAllMessages<IndexedMessage>(ownerField, std::string("owner1"));
+        REQUIRE(owned.size() == 7);
+        for (size_t i = 0; i < owned.size(); ++i)
+            REQUIRE_NOTHROW(EqualMessages(owned[i], msgList[i * 3 + 1]));
+
+        auto first = db.findMessage<IndexedMessage>(categoryField, std::string("odd"));
+        REQUIRE(first.has_value());
+        REQUIRE_NOTHROW(EqualMessages(first.value(), msgList[1]));
+
+        REQUIRE(db.findAllMessages<IndexedMessage>(ownerField, std::string("nobody")).empty());
+        REQUIRE_THROWS(db.findAllMessages<IndexedMessage>(scoreField, 1));
+
+        REQUIRE_NOTHROW(db.deleteMessage<IndexedMessage>(categoryField, std::string("even")));
+        REQUIRE(db.getAllMessages<IndexedMessage>().size() == 10);
+
+        IndexedBlobMessage blob;
+        blob.set_name("first");
+        blob.set_group("group");
+        blob.add_values(1);
+        REQUIRE_NOTHROW(db.writeMessage(blob));
+        blob.set_name("second");
+        blob.add_values(2);
+        REQUIRE_NOTHROW(db.writeMessage(blob));
+
+        auto groupField = IndexedBlobMessage::GetDescriptor()->FindFieldByNumber(IndexedBlobMessage::kGroupFieldNumber);
+        auto grouped = db.findAllMessages<IndexedBlobMessage>(groupField, std::string("group"));
+        REQUIRE(grouped.size() == 2);
+        REQUIRE_NOTHROW(EqualMessages(grouped[1], blob));
+    }
+
+    {
+        SQLite::Database raw(path, SQLite::OPEN_READONLY);
+        SQLite::Statement query(raw, "SELECT name FROM sqlite_master WHERE type='index' AND name LIKE 'index_%' ORDER BY name;");
+        std::vector<std::string> indexes;
+        while (query.executeStep())
+            indexes.emplace_back(query.getColumn(0).getString());
+        REQUIRE(indexes == std::vector<std::string>{ "index_IndexedBlobMessage_group", "index_IndexedMessage_category_score", "index_IndexedMessage_owner" });
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Message key rewrite test", "[smoketest]") {
+    Database db;
+
+    REQUIRE_NOTHROW(db.createTable<ComplexKeyTestMessage>());
+
+    ComplexKeyTestMessage msg;
+    msg.mutable_pos()->set_x(1);
+    msg.mutable_pos()->set_y(2);
+    msg.set_data("first");
+    REQUIRE_NOTHROW(db.writeMessage(msg));
+
+    msg.set_data("second");
+    REQUIRE_NOTHROW(db.writeMessage(msg));
+
+    auto res = db.getAllMessages<ComplexKeyTestMessage>();
+    REQUIRE(res.size() == 1);
+    REQUIRE_NOTHROW(EqualMessages(res[0], msg));
+}
+
+TEST_CASE("Database stats test", "[smoketest]") {
+    DatabaseOptions options;
+    options.collectStats = true;
+    Database db(options);
+
+    REQUIRE_NOTHROW(db.createTable<TestKeyMessage>());
+
+    std::vector<TestKeyMessage> msgList;
+    for (int i = 0; i < 10; ++i)
+    {
+        TestKeyMessage msg;
+        msg.set_index(i);
+        msg.set_data(generate_random_string(20));
+        msg.add_numvalues(i);
+        msgList.emplace_back(std::move(msg));
+    }
+    for (const auto& msg : msgList)
+        REQUIRE_NOTHROW(db.insertMessage(msg));
+
+    auto field = TestKeyMessage::GetDescriptor()->FindFieldByNumber(TestKeyMessage::kIndexFieldNumber);
+    for (int i = 0; i < 5; ++i)
+        REQUIRE(db.findMessage<TestKeyMessage>(field, i).has_value());
+    REQUIRE(db.getAllMessages<TestKeyMessage>().size() == msgList.size());
+
+    auto stats = db.getStats();
+    REQUIRE(stats.getOperation(DatabaseStats::Operation::CreateTable).count == 1);
+    REQUIRE(stats.getOperation(DatabaseStats::Operation::InsertMessage).count == 10);
+    REQUIRE(stats.getOperation(DatabaseStats::Operation::FindMessage).count == 5);
+    REQUIRE(stats.getOperation(DatabaseStats::Operation::GetAllMessages).count == 1);
+    REQUIRE(stats.getOperation(DatabaseStats::Operation::WriteMessage).count == 0);
+    REQUIRE(stats.commits.count == 11);
+    REQUIRE(stats.rowsWritten == 20);
+    REQUIRE(stats.rowsRead >= 30);
+    REQUIRE(stats.statements > 30);
+    REQUIRE(stats.statementCache.misses > 0);
+    REQUIRE(stats.statementCache.hits > 0);
+
+    const auto& inserts = stats.getOperation(DatabaseStats::Operation::InsertMessage);
+    REQUIRE(inserts.getPercentile(0.5) <= inserts.getPercentile(0.99));
+    REQUIRE(inserts.getPercentile(0.99) <= inserts.max);
+    REQUIRE(inserts.getMean() > std::chrono::nanoseconds{ 0 });
+
+    REQUIRE_NOTHROW(db.setStatsEnabled(false));
+    REQUIRE_NOTHROW(db.writeMessage(msgList[0]));
+    REQUIRE(db.getStats().getOperation(DatabaseStats::Operation::WriteMessage).count == 0);
+    REQUIRE(db.getStats().rowsWritten == 20);
+
+    REQUIRE_NOTHROW(db.resetStats());
+    REQUIRE_NOTHROW(db.setStatsEnabled(true));
+    REQUIRE_NOTHROW(db.deleteMessage<TestKeyMessage>(field, 3));
+    stats = db.getStats();
+    REQUIRE(stats.getOperation(DatabaseStats::Operation::InsertMessage).count == 0);
+    REQUIRE(stats.getOperation(DatabaseStats::Operation::DeleteMessage).count == 1);
+    REQUIRE(stats.rowsWritten == 1);
+}
+
+TEST_CASE("Message cache test", "[smoketest]") {
+    DatabaseOptions options;
+    options.messageCacheCapacity = 1 << 20;
+    Database db(options);
+
+    REQUIRE_NOTHROW(db.createTable<StringKeyMessage>());
+    REQUIRE_NOTHROW(db.createTable<ComplexKeyTestMessage>());
+
+    auto nameField = StringKeyMessage::GetDescriptor()->FindFieldByNumber(StringKeyMessage::kNameFieldNumber);
+
+    StringKeyMessage msg;
+    msg.set_name("key");
+    msg.set_number(1);
+    REQUIRE_NOTHROW(db.writeMessage(msg));
+
+    for (int i = 0; i < 3; ++i)
+    {
+        auto res = db.findMessage<StringKeyMessage>(nameField, std::string("key"));
+        REQUIRE(res.has_value());
+        REQUIRE_NOTHROW(EqualMessages(res.value(), msg));
+    }
+    auto stats = db.getStats().messageCache;
+    REQUIRE(stats.misses == 1);
+    REQUIRE(stats.hits == 2);
+    REQUIRE(stats.entries == 1);
+
+    msg.set_number(2);
+    REQUIRE_NOTHROW(db.writeMessage(msg));
+    REQUIRE(db.findMessage<StringKeyMessage>(nameField, std::string("key"))->number() == 2);
+
+    google::protobuf::Arena arena;
+    auto arenaMessage = db.findMessage<StringKeyMessage>(nameField, std::string("key"), &arena);
+    REQUIRE(arenaMessage);
+    REQUIRE(arenaMessage->number() == 2);
+
+    {
+        auto transaction = db.beginBatch();
+        msg.set_number(3);
+        REQUIRE_NOTHROW(db.writeMessage(msg));
+        REQUIRE(db.findMessage<StringKeyMessage>(nameField, std::string("key"))->number() == 3);
+    }
+    REQUIRE(db.findMessage<StringKeyMessage>(nameField, std::string("key"))->number() == 2);
+
+    REQUIRE_NOTHROW(db.deleteMessage<StringKeyMessage>(nameField, std::string("key")));
+    REQUIRE_FALSE(db.findMessage<StringKeyMessage>(nameField, std::string("key")).has_value());
+
+    ComplexKeyTestMessage complex;
+    complex.mutable_pos()->set_x(1);
+    complex.mutable_pos()->set_y(1);
+    complex.set_data("data");
+    REQUIRE_NOTHROW(db.writeMessage(complex));
+
+    auto posField = ComplexKeyTestMessage::GetDescriptor()->FindFieldByNumber(ComplexKeyTestMessage::kPosFieldNumber);
+    REQUIRE(db.findMessage<ComplexKeyTestMessage>(posField, complex.pos()).has_value());
+    REQUIRE(db.getStats().messageCache.entries == 1);
+
+    // rows of nested type are changed together with rows of owners
+    REQUIRE_NOTHROW(db.clearTable<ComplexKeyTestMessage::Position>());
+    REQUIRE(db.getStats().messageCache.entries == 0);
+
+    REQUIRE_NOTHROW(db.setMessageCacheCapacity(1));
+    msg.set_name("other");
+    REQUIRE_NOTHROW(db.writeMessage(msg));
+    REQUIRE(db.findMessage<StringKeyMessage>(nameField, std::string("other")).has_value());
+    REQUIRE(db.getStats().messageCache.entries == 0);
+}
+
+TEST_CASE("Message cache invalidation test", "[smoketest]") {
+    MessageCache cache(1 << 20);
+
+    // owner is only registered, messages of its nested type are cached
+    cache.registerType(ComplexKeyTestMessage::GetDescriptor());
+    cache.registerType(StringKeyMessage::GetDescriptor());
+
+    auto xField = ComplexKeyTestMessage::Position::GetDescriptor()->FindFieldByNumber(ComplexKeyTestMessage::Position::kXFieldNumber);
+    ComplexKeyTestMessage::Position pos;
+    pos.set_x(1);
+    cache.insert(xField, 1, pos);
+    REQUIRE(cache.getStats().entries == 1);
+
+    cache.invalidate(std::string("StringKeyMessage"));
+    REQUIRE(cache.getStats().entries == 1);
+    cache.invalidate(std::string("ComplexKeyTestMessage"));
+    REQUIRE(cache.getStats().entries == 0);
+
+    cache.insert(xField, 1, pos);
+    cache.invalidate(std::string("UnknownMessage"));
+    REQUIRE(cache.getStats().entries == 0);
+
+    // keys of message type are serialized deterministically
+    auto dataField = TestMap::GetDescriptor()->FindFieldByNumber(TestMap::kDataFieldNumber);
+    TestMap first;
+    TestMap second;
+    for (int i = 0; i < 50; ++i)
+    {
+        (*first.mutable_data())["key" + std::to_string(i)] = i;
+        (*second.mutable_data())["key" + std::to_string(49 - i)] = 49 - i;
+    }
+    cache.insert(dataField, first, pos);
+    REQUIRE(cache.find(dataField, second) != nullptr);
+
+    // floating point keys differing after 6 decimal places have separate entries
+    auto amountField = ScalarMessage::GetDescriptor()->FindFieldByNumber(ScalarMessage::kAmountFieldNumber);
+    cache.insert(amountField, 1e-7, pos);
+    REQUIRE(cache.find(amountField, 1e-7) != nullptr);
+    REQUIRE(cache.find(amountField, 2e-7) == nullptr);
+}
+
+TEST_CASE("Message cache shared nested type test", "[smoketest]") {
+    DatabaseOptions options;
+    options.messageCacheCapacity = 1 << 20;
+    Database db(options);
+
+    REQUIRE_NOTHROW(db.createTable<FirstHolder>());
+    REQUIRE_NOTHROW(db.createTable<SecondHolder>());
+
+    FirstHolder first;
+    first.set_id(1);
+    first.mutable_item()->set_id(7);
+    first.mutable_item()->set_title("initial");
+    REQUIRE_NOTHROW(db.writeMessage(first));
+
+    SecondHolder second;
+    second.set_id(1);
+    second.mutable_item()->set_id(7);
+    second.mutable_item()->set_title("initial");
+    REQUIRE_NOTHROW(db.writeMessage(second));
+
+    auto idField = SecondHolder::GetDescriptor()->FindFieldByNumber(SecondHolder::kIdFieldNumber);
+    REQUIRE(db.findMessage<SecondHolder>(idField, 1)->item().title() == "initial");
+    REQUIRE(db.findMessage<SecondHolder>(idField, 1)->item().title() == "initial");
+    REQUIRE(db.getStats().messageCache.hits == 1);
+
+    // the shared item is upserted by its key through the other owner
+    first.mutable_item()->set_title("updated");
+    REQUIRE_NOTHROW(db.writeMessage(first));
+    REQUIRE(db.findMessage<SecondHolder>(idField, 1)->item().title() == "updated");
+}
+
+TEST_CASE("Lazy read test", "[smoketest]") {
+    Database db;
+
+    srand(0);
+
+    REQUIRE_NOTHROW(db.createTable<ComplexMessage>());
+    REQUIRE_NOTHROW(db.createTable<TestKeyMessage>());
+
+    std::vector<ComplexMessage> messages;
+    for (int i = 0; i < 5; ++i)
+    {
+        ComplexMessage msg;
+        for (int j = 0; j < 3; ++j)
+        {
+            ComplexMessage::NestedMessage nested;
+            nested.set_name(generate_random_string(10));
+            nested.add_value(rand());
+            msg.mutable_msg()->Add(std::move(nested));
+        }
+        msg.mutable_values()->Add(rand());
+        ComplexMessage::MapMessage mapMsg;
+        mapMsg.set_value(i);
+        mapMsg.add_str(generate_random_string(5));
+        msg.mutable_messagemap()->emplace(generate_random_string(5), std::move(mapMsg));
+        msg.set_str(generate_random_string(10));
+        msg.set_numvalue(i);
+        REQUIRE_NOTHROW(db.writeMessage(msg));
+        messages.emplace_back(std::move(msg));
+    }
+
+    auto lazyList = db.getAllMessages<ComplexMessage>(ReadMode::Lazy);
+    REQUIRE(lazyList.size() == messages.size());
+    for (size_t i = 0; i < lazyList.size(); ++i)
+    {
+        REQUIRE(lazyList[i].str() == messages[i].str());
+        REQUIRE(lazyList[i].numvalue() == messages[i].numvalue());
+        REQUIRE(lazyList[i].msg_size() == 0);
+        REQUIRE(lazyList[i].values_size() == 0);
+        REQUIRE(lazyList[i].messagemap_size() == 0);
+    }
+
+    auto descriptor = ComplexMessage::GetDescriptor();
+    size_t index = 0;
+    auto cursor = db.getMessageCursor<ComplexMessage>(nullptr, ReadMode::Lazy);
+    while (cursor.next())
+    {
+        ComplexMessage msg = cursor.current();
+        REQUIRE(msg.msg_size() == 0);
+        REQUIRE_NOTHROW(db.loadField(&msg, descriptor->FindFieldByNumber(ComplexMessage::kMsgFieldNumber), cursor.getId()));
+        REQUIRE_NOTHROW(db.loadField(&msg, descriptor->FindFieldByNumber(ComplexMessage::kValuesFieldNumber), cursor.getId()));
+        REQUIRE_NOTHROW(db.loadField(&msg, descriptor->FindFieldByNumber(ComplexMessage::kMessageMapFieldNumber), cursor.getId()));
+        REQUIRE_NOTHROW(EqualMessages(msg, messages[index]));
+        ++index;
+    }
+    REQUIRE(index == messages.size());
+
+    REQUIRE_THROWS(db.loadField(&lazyList[0], descriptor->FindFieldByNumber(ComplexMessage::kMsgFieldNumber)));
+
+    TestKeyMessage keyMsg;
+    keyMsg.set_index(5);
+    keyMsg.set_data("data");
+    keyMsg.add_numvalues(1);
+    keyMsg.add_numvalues(2);
+    REQUIRE_NOTHROW(db.writeMessage(keyMsg));
+
+    auto indexField = TestKeyMessage::GetDescriptor()->FindFieldByNumber(TestKeyMessage::kIndexFieldNumber);
+    auto lazyKeyMsg = db.findMessage<TestKeyMessage>(indexField, 5, ReadMode::Lazy);
+    REQUIRE(lazyKeyMsg.has_value());
+    REQUIRE(lazyKeyMsg->numvalues_size() == 0);
+    REQUIRE_NOTHROW(db.loadField(&lazyKeyMsg.value(), TestKeyMessage::GetDescriptor()->FindFieldByNumber(TestKeyMessage::kNumValuesFieldNumber)));
+    REQUIRE_NOTHROW(EqualMessages(lazyKeyMsg.value(), keyMsg));
+}
+
+TEST_CASE("Projection read test", "[smoketest]") {
+    Database db;
+
+    srand(0);
+
+    REQUIRE_NOTHROW(db.createTable<ComplexMessage>());
+    REQUIRE_NOTHROW(db.createTable<TestKeyMessage>());
+    REQUIRE_NOTHROW(db.createTable<BlobMessage>());
+
+    std::vector<ComplexMessage> messages;
+    for (int i = 0; i < 5; ++i)
+    {
+        ComplexMessage msg;
+        ComplexMessage::NestedMessage nested;
+        nested.set_name(generate_random_string(10));
+        nested.add_value(rand());
+        msg.mutable_msg()->Add(std::move(nested));
+        msg.mutable_values()->Add(rand());
+        msg.set_str(generate_random_string(10));
+        msg.set_numvalue(i);
+        REQUIRE_NOTHROW(db.writeMessage(msg));
+        messages.emplace_back(std::move(msg));
+    }
+
+    google::protobuf::FieldMask mask;
+    mask.add_paths("numValue");
+    mask.add_paths("values");
+
+    auto list = db.getAllMessages<ComplexMessage>(mask);
+    REQUIRE(list.size() == messages.size());
+    for (size_t i = 0; i < list.size(); ++i)
+    {
+        REQUIRE(list[i].numvalue() == messages[i].numvalue());
+        REQUIRE(list[i].values_size() == 1);
+        REQUIRE(list[i].values(0) == messages[i].values(0));
+        REQUIRE(list[i].str().empty());
+        REQUIRE(list[i].msg_size() == 0);
+    }
+
+    auto descriptor = ComplexMessage::GetDescriptor();
+    std::vector<const google::protobuf::FieldDescriptor*> fields{ descriptor->FindFieldByNumber(ComplexMessage::kMsgFieldNumber) };
+    list = db.getAllMessages<ComplexMessage>(fields);
+    REQUIRE(list.size() == messages.size());
+    for (size_t i = 0; i < list.size(); ++i)
+    {
+        REQUIRE(list[i].numvalue() == 0);
+        REQUIRE(list[i].values_size() == 0);
+        REQUIRE(list[i].msg_size() == 1);
+        REQUIRE(list[i].msg(0).name() == messages[i].msg(0).name());
+    }
+
+    google::protobuf::FieldMask wrongMask;
+    wrongMask.add_paths("unknown");
+    REQUIRE_THROWS(db.getAllMessages<ComplexMessage>(wrongMask));
+
+    TestKeyMessage keyMsg;
+    keyMsg.set_index(5);
+    keyMsg.set_data("data");
+    keyMsg.add_numvalues(1);
+    REQUIRE_NOTHROW(db.writeMessage(keyMsg));
+
+    auto indexField = TestKeyMessage::GetDescriptor()->FindFieldByNumber(TestKeyMessage::kIndexFieldNumber);
+    google::protobuf::FieldMask keyMask;
+    keyMask.add_paths("data");
+    auto keyRes = db.findMessage<TestKeyMessage>(indexField, 5, keyMask);
+    REQUIRE(keyRes.has_value());
+    REQUIRE(keyRes->index() == 0);
+    REQUIRE(keyRes->data() == "data");
+    REQUIRE(keyRes->numvalues_size() == 0);
+    REQUIRE_FALSE(db.findMessage<TestKeyMessage>(indexField, 6, keyMask).has_value());
+
+    BlobMessage blob;
+    blob.set_name("blob");
+    blob.set_weight(1.5);
+    blob.mutable_counters()->insert({ "a", 1 });
+    REQUIRE_NOTHROW(db.writeMessage(blob));
+
+    google::protobuf::FieldMask blobMask;
+    blobMask.add_paths("weight");
+    auto blobRes = db.findMessage<BlobMessage>(BlobMessage::GetDescriptor()->FindFieldByNumber(BlobMessage::kNameFieldNumber), std::string("blob"), blobMask);
+    REQUIRE(blobRes.has_value());
+    REQUIRE(blobRes->weight() == 1.5);
+    REQUIRE(blobRes->name().empty());
+    REQUIRE(blobRes->counters().empty());
+}
+
+TEST_CASE("Generated accessors test", "[smoketest]") {
+    registerStorageAccessors();
+
+    Database db;
+
+    auto descriptor = ScalarMessage::GetDescriptor();
+    REQUIRE(TablePlan::findAccessors(descriptor->FindFieldByNumber(ScalarMessage::kIdFieldNumber)) != nullptr);
+    REQUIRE(TablePlan::findAccessors(descriptor->FindFieldByNumber(ScalarMessage::kNamesFieldNumber)) != nullptr);
+    REQUIRE(TablePlan::findAccessors(descriptor->FindFieldByNumber(ScalarMessage::kCountersFieldNumber)) == nullptr);
+    REQUIRE(TablePlan::findAccessors(TestMessage::GetDescriptor()->field(0)) == nullptr);
+
+    REQUIRE_NOTHROW(db.createTable<ScalarMessage>());
+
+    std::vector<ScalarMessage> messages;
+    for (int i = 0; i < 10; ++i)
+    {
+        ScalarMessage msg;
+        msg.set_id(std::numeric_limits<uint64_t>::max() - i);
+        msg.set_count(std::numeric_limits<uint32_t>::max() - i);
+        msg.set_delta(-i);
+        msg.set_flag(i % 2 == 0);
+        msg.set_ratio(0.5f * i);
+        msg.set_amount(1.25 * i);
+        msg.set_payload(std::string("\0data", 5) + std::to_string(i));
+        msg.set_kind(static_cast<ScalarMessage::Kind>(i % 3));
+        msg.set_comment(generate_random_string(8));
+        msg.add_names(generate_random_string(5));
+        msg.add_names(generate_random_string(5));
+        msg.add_kinds(ScalarMessage::SECOND);
+        msg.add_flags(true);
+        msg.add_flags(false);
+        (*msg.mutable_counters())["counter"] = i;
+        REQUIRE_NOTHROW(db.writeMessage(msg));
+        messages.emplace_back(std::move(msg));
+    }
+
+    auto list = db.getAllMessages<ScalarMessage>();
+    REQUIRE(list.size() == messages.size());
+    for (size_t i = 0; i < list.size(); ++i)
+        REQUIRE_NOTHROW(EqualMessages(list[i], messages[i]));
+
+    auto idField = descriptor->FindFieldByNumber(ScalarMessage::kIdFieldNumber);
+    auto found = db.findMessage<ScalarMessage>(idField, static_cast<int64_t>(messages[3].id()));
+    REQUIRE(found.has_value());
+    REQUIRE_NOTHROW(EqualMessages(found.value(), messages[3]));
+
+    // dynamic message of the same type isn't an instance of the generated class
+    google::protobuf::DynamicMessageFactory factory;
+    std::unique_ptr<google::protobuf::Message> dynamic(factory.GetPrototype(descriptor)->New());
+    dynamic->CopyFrom(messages[3]);
+    dynamic->GetReflection()->SetUInt64(dynamic.get(), idField, 42);
+    REQUIRE_NOTHROW(db.writeMessage(*dynamic));
+
+    found = db.findMessage<ScalarMessage>(idField, static_cast<int64_t>(42));
+    REQUIRE(found.has_value());
+    REQUIRE(found->id() == 42);
+    REQUIRE(found->payload() == messages[3].payload());
+    REQUIRE(found->names_size() == messages[3].names_size());
+    REQUIRE(found->names(1) == messages[3].names(1));
+}
+
+TEST_CASE("Incremental update test", "[smoketest]") {
+    DatabaseOptions options;
+    options.collectStats = true;
+    Database db(options);
+
+    REQUIRE_NOTHROW(db.createTable<TestKeyMessage>());
+    REQUIRE_NOTHROW(db.createTable<ScalarMessage>());
+
+    auto indexField = TestKeyMessage::GetDescriptor()->FindFieldByNumber(TestKeyMessage::kIndexFieldNumber);
+
+    TestKeyMessage msg;
+    msg.set_index(1);
+    msg.set_data("data");
+    for (int i = 0; i < 100; ++i)
+        msg.add_numvalues(i);
+    REQUIRE_NOTHROW(db.writeMessage(msg));
+
+    db.resetStats();
+    msg.set_data("updated");
+    REQUIRE_NOTHROW(db.writeMessage(msg));
+    REQUIRE(db.getStats().rowsWritten == 1);
+
+    db.resetStats();
+    msg.add_numvalues(100);
+    REQUIRE_NOTHROW(db.writeMessage(msg));
+    REQUIRE(db.getStats().rowsWritten == 2);
+    REQUIRE_NOTHROW(EqualMessages(db.findMessage<TestKeyMessage>(indexField, 1).value(), msg));
+
+    db.resetStats();
+    msg.mutable_numvalues()->Truncate(50);
+    REQUIRE_NOTHROW(db.writeMessage(msg));
+    REQUIRE(db.getStats().rowsWritten == 52);
+    REQUIRE_NOTHROW(EqualMessages(db.findMessage<TestKeyMessage>(indexField, 1).value(), msg));
+
+    msg.mutable_numvalues()->SwapElements(0, 1);
+    msg.set_numvalues(10, 1000);
+    REQUIRE_NOTHROW(db.writeMessage(msg));
+    REQUIRE_NOTHROW(EqualMessages(db.findMessage<TestKeyMessage>(indexField, 1).value(), msg));
+
+    msg.clear_numvalues();
+    REQUIRE_NOTHROW(db.writeMessage(msg));
+    REQUIRE_NOTHROW(EqualMessages(db.findMessage<TestKeyMessage>(indexField, 1).value(), msg));
+
+    ScalarMessage scalar;
+    scalar.set_id(1);
+    scalar.set_comment("comment");
+    for (int i = 0; i < 20; ++i)
+        (*scalar.mutable_counters())["counter" + std::to_string(i)] = i;
+    REQUIRE_NOTHROW(db.writeMessage(scalar));
+
+    db.resetStats();
+    (*scalar.mutable_counters())["counter0"] = 100;
+    scalar.mutable_counters()->erase("counter1");
+    (*scalar.mutable_counters())["counter20"] = 20;
+    REQUIRE_NOTHROW(db.writeMessage(scalar));
+    REQUIRE(db.getStats().rowsWritten == 4);
+
+    auto idField = ScalarMessage::GetDescriptor()->FindFieldByNumber(ScalarMessage::kIdFieldNumber);
+    auto found = db.findMessage<ScalarMessage>(idField, 1);
+    REQUIRE(found.has_value());
+    REQUIRE(google::protobuf::util::MessageDifferencer::Equals(found.value(), scalar));
+
+    REQUIRE_NOTHROW(db.createTable<OwnerMessage>());
+
+    OwnerMessage owner;
+    owner.set_id(1);
+    owner.set_name("owner");
+    for (int i = 0; i < 20; ++i)
+    {
+        auto item = owner.add_items();
+        item->set_title("item" + std::to_string(i));
+        item->add_values(i);
+        (*owner.mutable_nameditems())["item" + std::to_string(i)].set_title("named" + std::to_string(i));
+    }
+    REQUIRE_NOTHROW(db.writeMessage(owner));
+
+    // changed nested message is updated in its row
+    db.resetStats();
+    owner.mutable_items(0)->set_title("changed");
+    REQUIRE_NOTHROW(db.writeMessage(owner));
+    REQUIRE(db.getStats().rowsWritten == 2);
+
+    db.resetStats();
+    owner.mutable_items()->SwapElements(5, 6);
+    owner.mutable_items()->RemoveLast();
+    REQUIRE_NOTHROW(db.writeMessage(owner));
+    REQUIRE(db.getStats().rowsWritten == 6);
+
+    db.resetStats();
+    (*owner.mutable_nameditems())["item0"].set_title("changed");
+    owner.mutable_nameditems()->erase("item1");
+    (*owner.mutable_nameditems())["item20"].set_title("named20");
+    REQUIRE_NOTHROW(db.writeMessage(owner));
+    REQUIRE(db.getStats().rowsWritten == 5);
+
+    auto ownerFound = db.findMessage<OwnerMessage>(OwnerMessage::GetDescriptor()->FindFieldByNumber(OwnerMessage::kIdFieldNumber), 1);
+    REQUIRE(ownerFound.has_value());
+    REQUIRE(google::protobuf::util::MessageDifferencer::Equals(ownerFound.value(), owner));
+}
+
+TEST_CASE("Incremental update of nested elements test", "[smoketest]") {
+    const auto path = (std::filesystem::temp_directory_path() / "ProtoDatabase-nested-update-test.db").string();
+    std::filesystem::remove(path);
+
+    auto countRows = [&path](const std::string& table) {
+        SQLite::Database raw(path, SQLite::OPEN_READONLY);
+        return raw.execAndGet("SELECT COUNT(*) FROM " + table + ";").getInt();
+    };
+
+    {
+        Database db(path);
+        REQUIRE_NOTHROW(db.createTable<OwnerMessage>());
+        REQUIRE_NOTHROW(db.createTable<SharedCatalog>());
+
+        OwnerMessage owner;
+        owner.set_id(1);
+        for (int i = 0; i < 5; ++i)
+        {
+            auto item = owner.add_items();
+            item->set_title("item" + std::to_string(i));
+            item->add_values(i);
+            (*owner.mutable_nameditems())["item" + std::to_string(i)].set_title("named" + std::to_string(i));
+        }
+        REQUIRE_NOTHROW(db.writeMessage(owner));
+
+        SharedCatalog catalog;
+        catalog.set_id(1);
+        for (int i = 0; i < 5; ++i)
+        {
+            auto item = catalog.add_items();
+            item->set_id(i);
+            item->set_title("item" + std::to_string(i));
+            auto& named = (*catalog.mutable_nameditems())["item" + std::to_string(i)];
+            named.set_id(i + 100);
+            named.set_title("named" + std::to_string(i));
+        }
+        REQUIRE_NOTHROW(db.writeMessage(catalog));
+
+        const int items = countRows("Item");
+        const int values = countRows("field_table_Item_values");
+        const int sharedItems = countRows("SharedItem");
+
+        // changed nested messages are updated in their rows, ones with keys are upserted by the key
+        for (int i = 0; i < 5; ++i)
+        {
+            owner.mutable_items(0)->set_title("changed" + std::to_string(i));
+            owner.mutable_items(0)->add_values(i);
+            (*owner.mutable_nameditems())["item0"].set_title("changed" + std::to_string(i));
+            (*owner.mutable_nameditems())["item1"].add_values(i);
+            REQUIRE_NOTHROW(db.writeMessage(owner));
+
+            catalog.mutable_items(0)->set_title("changed" + std::to_string(i));
+            (*catalog.mutable_nameditems())["item0"].set_title("changed" + std::to_string(i));
+            REQUIRE_NOTHROW(db.writeMessage(catalog));
+        }
+
+        REQUIRE(countRows("Item") == items);
+        REQUIRE(countRows("field_table_Item_values") == values + 10);
+        REQUIRE(countRows("SharedItem") == sharedItems);
+
+        auto ownerFound = db.findMessage<OwnerMessage>(OwnerMessage::GetDescriptor()->FindFieldByNumber(OwnerMessage::kIdFieldNumber), 1);
+        REQUIRE(ownerFound.has_value());
+        REQUIRE(google::protobuf::util::MessageDifferencer::Equals(ownerFound.value(), owner));
+
+        auto catalogFound = db.findMessage<SharedCatalog>(SharedCatalog::GetDescriptor()->FindFieldByNumber(SharedCatalog::kIdFieldNumber), 1);
+        REQUIRE(catalogFound.has_value());
+        REQUIRE(google::protobuf::util::MessageDifferencer::Equals(catalogFound.value(), catalog));
+    }
+
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("Append repeated test", "[smoketest]") {
+    DatabaseOptions options;
+    options.collectStats = true;
+    Database db(options);
+
+    REQUIRE_NOTHROW(db.createTable<TestKeyMessage>());
+    REQUIRE_NOTHROW(db.createTable<ScalarMessage>());
+    REQUIRE_NOTHROW(db.createTable<BlobMessage>());
+
+    auto descriptor = TestKeyMessage::GetDescriptor();
+    auto indexField = descriptor->FindFieldByNumber(TestKeyMessage::kIndexFieldNumber);
+    auto valuesField = descriptor->FindFieldByNumber(TestKeyMessage::kNumValuesFieldNumber);
+
+    TestKeyMessage msg;
+    msg.set_index(1);
+    msg.set_data("data");
+    msg.add_numvalues(1);
+    REQUIRE_NOTHROW(db.writeMessage(msg));
+
+    REQUIRE(db.findMessage<TestKeyMessage>(indexField, 1).has_value());
+
+    db.resetStats();
+    std::vector<int64_t> values;
+    for (int64_t i = 2; i < 2000; ++i)
+        values.emplace_back(i);
+    REQUIRE(db.appendRepeated<TestKeyMessage>(indexField, 1, valuesField, std::span<const int64_t>(values)) == 1);
+    REQUIRE(db.getStats().rowsWritten == values.size());
+    for (auto value : values)
+        msg.add_numvalues(value);
+
+    REQUIRE(db.appendRepeated<TestKeyMessage>(indexField, 1, valuesField, { int64_t(-1), int64_t(-2) }) == 1);
+    msg.add_numvalues(-1);
+    msg.add_numvalues(-2);
+
+    // values already stored in the field and repeated in one call
+    REQUIRE(db.appendRepeated<TestKeyMessage>(indexField, 1, valuesField, { int64_t(1), int64_t(-2), int64_t(-2) }) == 1);
+    msg.add_numvalues(1);
+    msg.add_numvalues(-2);
+    msg.add_numvalues(-2);
+
+    auto found = db.findMessage<TestKeyMessage>(indexField, 1);
+    REQUIRE(found.has_value());
+    REQUIRE_NOTHROW(EqualMessages(found.value(), msg));
+
+    REQUIRE(db.appendRepeated<TestKeyMessage>(indexField, 2, valuesField, { int64_t(3) }) == 0);
+    REQUIRE_THROWS(db.appendRepeated<TestKeyMessage>(indexField, 1, valuesField, { std::string("text") }));
+    REQUIRE_THROWS(db.appendRepeated<TestKeyMessage>(indexField, 1, indexField, { 3 }));
+
+    ScalarMessage scalar;
+    scalar.set_id(std::numeric_limits<uint64_t>::max());
+    scalar.set_comment("comment");
+    scalar.add_names("first");
+    REQUIRE_NOTHROW(db.writeMessage(scalar));
+
+    auto scalarDescriptor = ScalarMessage::GetDescriptor();
+    auto idField = scalarDescriptor->FindFieldByNumber(ScalarMessage::kIdFieldNumber);
+    REQUIRE(db.appendRepeated<ScalarMessage>(idField, std::numeric_limits<uint64_t>::max(), scalarDescriptor->FindFieldByNumber(ScalarMessage::kNamesFieldNumber), { std::string("second") }) == 1);
+    REQUIRE(db.appendRepeated<ScalarMessage>(idField, std::numeric_limits<uint64_t>::max(), scalarDescriptor->FindFieldByNumber(ScalarMessage::kKindsFieldNumber), { ScalarMessage::FIRST, ScalarMessage::SECOND }) == 1);
+    REQUIRE(db.appendRepeated<ScalarMessage>(idField, std::numeric_limits<uint64_t>::max(), scalarDescriptor->FindFieldByNumber(ScalarMessage::kFlagsFieldNumber), { true, false }) == 1);
+    scalar.add_names("second");
+    scalar.add_kinds(ScalarMessage::FIRST);
+    scalar.add_kinds(ScalarMessage::SECOND);
+    scalar.add_flags(true);
+    scalar.add_flags(false);
+
+    auto scalarFound = db.findMessage<ScalarMessage>(idField, static_cast<int64_t>(std::numeric_limits<uint64_t>::max()));
+    REQUIRE(scalarFound.has_value());
+    REQUIRE_NOTHROW(EqualMessages(scalarFound.value(), scalar));
+
+    scalar.add_names("first");
+    scalar.add_names("first");
+    REQUIRE_NOTHROW(db.writeMessage(scalar));
+    scalarFound = db.findMessage<ScalarMessage>(idField, static_cast<int64_t>(std::numeric_limits<uint64_t>::max()));
+    REQUIRE(scalarFound.has_value());
+    REQUIRE_NOTHROW(EqualMessages(scalarFound.value(), scalar));
+
+    auto blobDescriptor = BlobMessage::GetDescriptor();
+    REQUIRE_THROWS(db.appendRepeated<BlobMessage>(blobDescriptor->FindFieldByNumber(BlobMessage::kNameFieldNumber), std::string("blob"), blobDescriptor->FindFieldByNumber(BlobMessage::kItemsFieldNumber), { 1 }));
+}
+
+TEST_CASE("Batch find test", "[smoketest]") {
+    DatabaseOptions options;
+    options.collectStats = true;
+    Database db(options);
+
+    srand(0);
+
+    REQUIRE_NOTHROW(db.createTable<OwnerMessage>());
+    REQUIRE_NOTHROW(db.createTable<ComplexKeyTestMessage>());
+
+    std::vector<OwnerMessage> messages;
+    for (int i = 0; i < 50; ++i)
+    {
+        OwnerMessage msg;
+        msg.set_id(i);
+        msg.set_name(generate_random_string(10));
+        for (int j = 0; j < i % 4; ++j)
+        {
+            auto item = msg.add_items();
+            item->set_title(generate_random_string(5));
+            item->add_values(j);
+            item->add_values(j + 1);
+
+            OwnerMessage::Item named;
+            named.set_title(generate_random_string(5));
+            named.add_values(i);
+            (*msg.mutable_nameditems())[generate_random_string(4)] = named;
+            (*msg.mutable_labels())[j] = generate_random_string(3);
+        }
+        REQUIRE_NOTHROW(db.writeMessage(msg));
+        messages.emplace_back(std::move(msg));
+    }
+
+    auto idField = OwnerMessage::GetDescriptor()->FindFieldByNumber(OwnerMessage::kIdFieldNumber);
+    std::vector<int> keys{ 7, 100, 3, 7, 0, 49, -1, 12 };
+
+    db.resetStats();
+    auto found = db.findMessages<OwnerMessage>(idField, keys);
+    REQUIRE(found.size() == keys.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        if (keys[i] < 0 || keys[i] >= static_cast<int>(messages.size()))
+        {
+            REQUIRE_FALSE(found[i].has_value());
+            continue;
+        }
+        REQUIRE(found[i].has_value());
+        REQUIRE(google::protobuf::util::MessageDifferencer::Equals(found[i].value(), messages[keys[i]]));
+    }
+    const auto batchStatements = db.getStats().statements;
+
+    db.resetStats();
+    for (int key : keys)
+        db.findMessage<OwnerMessage>(idField, key);
+    REQUIRE(db.getStats().statements > batchStatements);
+
+    REQUIRE(db.findMessages<OwnerMessage>(idField, std::vector<int>{}).empty());
+
+    std::vector<ComplexKeyTestMessage> keyMessages;
+    for (int i = 0; i < 10; ++i)
+    {
+        ComplexKeyTestMessage msg;
+        msg.mutable_pos()->set_x(i);
+        msg.mutable_pos()->set_y(-i);
+        msg.set_data(generate_random_string(10));
+        msg.add_numvalues(i);
+        REQUIRE_NOTHROW(db.writeMessage(msg));
+        keyMessages.emplace_back(std::move(msg));
+    }
+
+    std::vector<ComplexKeyTestMessage::Position> positions;
+    for (int i : { 4, 20, 0, 9 })
+    {
+        ComplexKeyTestMessage::Position pos;
+        pos.set_x(i);
+        pos.set_y(-i);
+        positions.emplace_back(std::move(pos));
+    }
+
+    auto posField = ComplexKeyTestMessage::GetDescriptor()->FindFieldByNumber(ComplexKeyTestMessage::kPosFieldNumber);
+    auto foundByMessage = db.findMessages<ComplexKeyTestMessage>(posField, positions);
+    REQUIRE(foundByMessage.size() == positions.size());
+    REQUIRE_NOTHROW(EqualMessages(foundByMessage[0].value(), keyMessages[4]));
+    REQUIRE_FALSE(foundByMessage[1].has_value());
+    REQUIRE_NOTHROW(EqualMessages(foundByMessage[2].value(), keyMessages[0]));
+    REQUIRE_NOTHROW(EqualMessages(foundByMessage[3].value(), keyMessages[9]));
+}
+
+TEST_CASE("Range scan test", "[smoketest]") {
+    Database db;
+
+    REQUIRE_NOTHROW(db.createTable<TestKeyMessage>());
+    REQUIRE_NOTHROW(db.createTable<IndexedMessage>());
+
+    std::vector<TestKeyMessage> messages;
+    for (int i = 0; i < 100; ++i)
+    {
+        TestKeyMessage msg;
+        msg.set_index(i);
+        msg.set_data(generate_random_string(8));
+        msg.add_numvalues(i);
+        REQUIRE_NOTHROW(db.writeMessage(msg));
+        messages.emplace_back(std::move(msg));
+    }
+
+    auto indexField = TestKeyMessage::GetDescriptor()->FindFieldByNumber(TestKeyMessage::kIndexFieldNumber);
+
+    ScanOptions options;
+    options.limit = 7;
+    std::vector<TestKeyMessage> scanned;
+    size_t pages = 0;
+    do
+    {
+        auto page = db.scanRange<TestKeyMessage, int32_t>(indexField, 10, 50, options);
+        REQUIRE(page.messages.size() <= options.limit);
+        for (auto& msg : page.messages)
+            scanned.emplace_back(std::move(msg));
+        options.resumeToken = page.resumeToken;
+        ++pages;
+    }
+    while (!options.resumeToken.empty());
+    REQUIRE(pages == 6);
+    REQUIRE(scanned.size() == 40);
+    for (size_t i = 0; i < scanned.size(); ++i)
+        REQUIRE_NOTHROW(EqualMessages(scanned[i], messages[10 + i]));
+
+    ScanOptions descending;
+    descending.order = ScanOrder::Descending;
+    descending.limit = 5;
+    auto page = db.scanRange<TestKeyMessage, int32_t>(indexField, std::nullopt, std::nullopt, descending);
+    REQUIRE(page.messages.size() == 5);
+    REQUIRE(page.messages[0].index() == 99);
+    REQUIRE(page.messages[4].index() == 95);
+    descending.resumeToken = page.resumeToken;
+    page = db.scanRange<TestKeyMessage, int32_t>(indexField, std::nullopt, 97, descending);
+    REQUIRE(page.messages.size() == 5);
+    REQUIRE(page.messages[0].index() == 94);
+
+    ScanOptions unlimited;
+    unlimited.limit = 0;
+    page = db.scanRange<TestKeyMessage, int32_t>(indexField, 95, std::nullopt, unlimited);
+    REQUIRE(page.messages.size() == 5);
+    REQUIRE(page.resumeToken.empty());
+
+    auto dataField = TestKeyMessage::GetDescriptor()->FindFieldByNumber(TestKeyMessage::kDataFieldNumber);
+    REQUIRE_THROWS(db.scanRange<TestKeyMessage, std::string>(dataField, std::string("a"), std::nullopt));
+
+    ScanOptions wrongToken;
+    wrongToken.resumeToken = "1:5";
+    REQUIRE_THROWS(db.scanRange<TestKeyMessage, int32_t>(indexField, std::nullopt, std::nullopt, wrongToken));
+
+    for (int i = 0; i < 30; ++i)
+    {
+        IndexedMessage msg;
+        msg.set_id(i);
+        msg.set_category(i % 3 == 0 ? "fruit" : "vegetable");
+        msg.set_owner(std::string(i % 2 == 0 ? "alice" : "albert") + std::to_string(i));
+        msg.set_score(i);
+        REQUIRE_NOTHROW(db.writeMessage(msg));
+    }
+
+    auto ownerField = IndexedMessage::GetDescriptor()->FindFieldByNumber(IndexedMessage::kOwnerFieldNumber);
+    ScanOptions prefixOptions;
+    prefixOptions.limit = 4;
+    std::vector<std::string> owners;
+    do
+    {
+        auto prefixPage = db.scanPrefix<IndexedMessage>(ownerField, "alic", prefixOptions);
+        for (const auto& msg : prefixPage.messages)
+            owners.emplace_back(msg.owner());
+        prefixOptions.resumeToken = prefixPage.resumeToken;
+    }
+    while (!prefixOptions.resumeToken.empty());
+    REQUIRE(owners.size() == 15);
+    REQUIRE(std::is_sorted(owners.begin(), owners.end()));
+    for (const auto& owner : owners)
+        REQUIRE(owner.rfind("alice", 0) == 0);
+
+    // duplicated values of the first column of a composite index are paged by ID
+    auto categoryField = IndexedMessage::GetDescriptor()->FindFieldByNumber(IndexedMessage::kCategoryFieldNumber);
+    ScanOptions categoryOptions;
+    categoryOptions.limit = 3;
+    std::vector<int32_t> ids;
+    do
+    {
+        auto categoryPage = db.scanRange<IndexedMessage, std::string>(categoryField, std::string("fruit"), std::string("fruit\x01"), categoryOptions);
+        for (const auto& msg : categoryPage.messages)
+            ids.emplace_back(msg.id());
+        categoryOptions.resumeToken = categoryPage.resumeToken;
+    }
+    while (!categoryOptions.resumeToken.empty());
+    REQUIRE(ids == std::vector<int32_t>{ 0, 3, 6, 9, 12, 15, 18, 21, 24, 27 });
+
+    REQUIRE_THROWS(db.scanPrefix<TestKeyMessage>(indexField, "1"));
+}
+
+TEST_CASE("Scan NULL values test", "[smoketest]") {
+    const auto path = (std::filesystem::temp_directory_path() / "ProtoDatabase-scan-null-test.db").string();
+    std::filesystem::remove(path);
+
+    {
+        Database db(path);
+        REQUIRE_NOTHROW(db.createTable<IndexedMessage>());
+        for (int i = 0; i < 10; ++i)
+        {
+            IndexedMessage msg;
+            msg.set_id(i);
+            msg.set_category("category");
+            msg.set_owner("owner" + std::to_string(i));
+            REQUIRE_NOTHROW(db.writeMessage(msg));
+        }
+    }
+
+    // rows written by other clients may keep NULL in the column
+    {
+        SQLite::Database raw(path, SQLite::OPEN_READWRITE);
+        raw.exec("UPDATE IndexedMessage SET field_owner=NULL WHERE field_id % 3 = 0;");
+    }
+
+    Database db(path);
+    REQUIRE_NOTHROW(db.createTable<IndexedMessage>());
+    auto ownerField = IndexedMessage::GetDescriptor()->FindFieldByNumber(IndexedMessage::kOwnerFieldNumber);
+
+    auto scan = [&db, ownerField](ScanOrder order) {
+        ScanOptions options;
+        options.order = order;
+        options.limit = 2;
+        std::vector<int32_t> ids;
+        do
+        {
+            auto page = db.scanRange<IndexedMessage, std::string>(ownerField, std::nullopt, std::nullopt, options);
+            for (const auto& msg : page.messages)
+                ids.emplace_back(msg.id());
+            options.resumeToken = page.resumeToken;
+        }
+        while (!options.resumeToken.empty());
+        return ids;
+    };
+
+    REQUIRE(scan(ScanOrder::Ascending) == std::vector<int32_t>{ 0, 3, 6, 9, 1, 2, 4, 5, 7, 8 });
+    REQUIRE(scan(ScanOrder::Descending) == std::vector<int32_t>{ 8, 7, 5, 4, 2, 1, 9, 6, 3, 0 });
+
+    ScanOptions wrongTag;
+    wrongTag.resumeToken = std::to_string(IndexedMessage::kOwnerFieldNumber) + ":1:x";
+    REQUIRE_THROWS(db.scanRange<IndexedMessage, std::string>(ownerField, std::nullopt, std::nullopt, wrongTag));
+}
+
+TEST_CASE("Query test", "[smoketest]") {
+    Database db;
+
+    REQUIRE_NOTHROW(db.createTable<TestMessage>());
+    REQUIRE_NOTHROW(db.createTable<ComplexKeyTestMessage>());
+
+    std::vector<TestMessage> messages;
+    for (int i = 0; i < 40; ++i)
+    {
+        TestMessage msg;
+        msg.set_value(i);
+        msg.set_stringvalue((i % 2 == 0 ? "even" : "odd") + std::to_string(i));
+        msg.mutable_nestedmessage()->set_value(i % 5);
+        msg.set_enumvalue(static_cast<TestMessage::TestEnum>(i % 4));
+        REQUIRE_NOTHROW(db.insertMessage(msg));
+        messages.emplace_back(std::move(msg));
+    }
+
+    const auto* descriptor = TestMessage::GetDescriptor();
+    auto valueField = descriptor->FindFieldByNumber(TestMessage::kValueFieldNumber);
+    auto stringField = descriptor->FindFieldByNumber(TestMessage::kStringValueFieldNumber);
+    auto nestedField = descriptor->FindFieldByNumber(TestMessage::kNestedMessageFieldNumber);
+    auto enumField = descriptor->FindFieldByNumber(TestMessage::kEnumValueFieldNumber);
+    auto nestedValueField = TestMessage::TestNestedMessage::GetDescriptor()->FindFieldByNumber(TestMessage::TestNestedMessage::kValueFieldNumber);
+
+    auto all = db.query<TestMessage>().getMessages();
+    REQUIRE(all.size() == messages.size());
+    for (size_t i = 0; i < all.size(); ++i)
+        REQUIRE_NOTHROW(EqualMessages(all[i], messages[i]));
+
+    auto greater = db.query<TestMessage>().where(valueField, Op::Gt, 30).getMessages();
+    REQUIRE(greater.size() == 9);
+    for (size_t i = 0; i < greater.size(); ++i)
+        REQUIRE_NOTHROW(EqualMessages(greater[i], messages[31 + i]));
+
+    auto page = db.query<TestMessage>().where(valueField, Op::Ge, 10).orderBy(valueField, ScanOrder::Descending).limit(3).offset(2).getMessages();
+    REQUIRE(page.size() == 3);
+    REQUIRE(page[0].value() == 37);
+    REQUIRE(page[2].value() == 35);
+
+    auto odd = db.query<TestMessage>().where(stringField, Op::Like, "odd%").where(valueField, Op::Lt, 10);
+    REQUIRE(odd.getCount() == 5);
+    auto oddMessages = odd.getMessages();
+    REQUIRE(oddMessages.size() == 5);
+    for (const auto& msg : oddMessages)
+        REQUIRE(msg.value() % 2 == 1);
+
+    auto nested = db.query<TestMessage>()
+        .where({ nestedField, nestedValueField }, Op::Eq, 3)
+        .where(enumField, Op::Ne, TestMessage::val1)
+        .orderBy({ nestedField, nestedValueField })
+        .getMessages();
+    std::vector<int32_t> values;
+    for (const auto& msg : nested)
+    {
+        REQUIRE(msg.nestedmessage().value() == 3);
+        REQUIRE(msg.enumvalue() != TestMessage::val1);
+        values.emplace_back(msg.value());
+    }
+    REQUIRE(values == std::vector<int32_t>{ 3, 8, 18, 23, 28, 38 });
+
+    auto first = db.query<TestMessage>().where(stringField, Op::Eq, std::string("even20")).getFirstMessage();
+    REQUIRE(first.has_value());
+    REQUIRE_NOTHROW(EqualMessages(*first, messages[20]));
+    REQUIRE_FALSE(db.query<TestMessage>().where(valueField, Op::Gt, 100).getFirstMessage().has_value());
+    REQUIRE(db.query<TestMessage>().where(valueField, Op::Gt, 100).getCount() == 0);
+
+    REQUIRE_THROWS(db.query<TestMessage>().where(valueField, Op::Eq, std::string("1")));
+    REQUIRE_THROWS(db.query<TestMessage>().where(valueField, Op::Like, 1));
+    REQUIRE_THROWS(db.query<TestMessage>().where(nestedField, Op::Eq, 1));
+    REQUIRE_THROWS(db.query<TestMessage>().where({ valueField, nestedValueField }, Op::Eq, 1));
+    REQUIRE_THROWS(db.query<TestMessage>().where(nestedValueField, Op::Eq, 1));
+
+    for (int i = 0; i < 10; ++i)
+    {
+        ComplexKeyTestMessage msg;
+        msg.mutable_pos()->set_x(i);
+        msg.mutable_pos()->set_y(i * 2);
+        msg.set_data(generate_random_string(8));
+        msg.add_numvalues(i);
+        msg.add_numvalues(i + 100);
+        REQUIRE_NOTHROW(db.writeMessage(msg));
+    }
+
+    auto posField = ComplexKeyTestMessage::GetDescriptor()->FindFieldByNumber(ComplexKeyTestMessage::kPosFieldNumber);
+    auto yField = ComplexKeyTestMessage::Position::GetDescriptor()->FindFieldByNumber(ComplexKeyTestMessage::Position::kYFieldNumber);
+    auto positions = db.query<ComplexKeyTestMessage>().where({ posField, yField }, Op::Ge, 14).getMessages();
+    REQUIRE(positions.size() == 3);
+    for (const auto& msg : positions)
+    {
+        REQUIRE(msg.pos().y() >= 14);
+        REQUIRE(msg.numvalues_size() == 2);
+        REQUIRE(msg.numvalues(1) == msg.pos().x() + 100);
+    }
+
+    // statements of queries are shared by SQL text and evicted with other statements
+    db.setStatementCacheCapacity(8);
+    REQUIRE(db.query<TestMessage>().where(valueField, Op::Eq, 1).getMessages().size() == 1);
+    const auto hits = db.getStatementCacheStats().hits;
+    REQUIRE(db.query<TestMessage>().where(valueField, Op::Eq, 2).getMessages().size() == 1);
+    REQUIRE(db.getStatementCacheStats().hits > hits);
+
+    for (int i = 1; i <= 20; ++i)
+    {
+        auto query = db.query<TestMessage>();
+        for (int j = 0; j < i; ++j)
+            query.where(valueField, Op::Ge, j);
+        REQUIRE(query.getCount() == 40 - (i - 1));
+        REQUIRE(db.getStatementCacheStats().size <= 8);
+    }
+}
+
+TEST_CASE("Aggregate test", "[smoketest]") {
+    Database db;
+
+    REQUIRE_NOTHROW(db.createTable<TestMessage>());
+
+    const auto* descriptor = TestMessage::GetDescriptor();
+    auto valueField = descriptor->FindFieldByNumber(TestMessage::kValueFieldNumber);
+    auto stringField = descriptor->FindFieldByNumber(TestMessage::kStringValueFieldNumber);
+    auto nestedField = descriptor->FindFieldByNumber(TestMessage::kNestedMessageFieldNumber);
+    auto enumField = descriptor->FindFieldByNumber(TestMessage::kEnumValueFieldNumber);
+    auto nestedValueField = TestMessage::TestNestedMessage::GetDescriptor()->FindFieldByNumber(TestMessage::TestNestedMessage::kValueFieldNumber);
+
+    REQUIRE(db.query<TestMessage>().aggregate<int64_t>(Aggregate::Count, valueField) == 0);
+    REQUIRE_FALSE(db.query<TestMessage>().aggregate<int64_t>(Aggregate::Sum, valueField).has_value());
+    REQUIRE_FALSE(db.query<TestMessage>().aggregate<int32_t>(Aggregate::Max, valueField).has_value());
+
+    for (int i = 1; i <= 20; ++i)
+    {
+        TestMessage msg;
+        msg.set_value(i);
+        msg.set_stringvalue("item" + std::to_string(100 + i));
+        msg.mutable_nestedmessage()->set_value(i * 10);
+        msg.set_enumvalue(static_cast<TestMessage::TestEnum>(i % 3));
+        REQUIRE_NOTHROW(db.insertMessage(msg));
+    }
+
+    auto all = db.query<TestMessage>();
+    REQUIRE(all.aggregate<int64_t>(Aggregate::Count, valueField) == 20);
+    REQUIRE(all.aggregate<int64_t>(Aggregate::Sum, valueField) == 210);
+    REQUIRE(all.aggregate<int32_t>(Aggregate::Min, valueField) == 1);
+    REQUIRE(all.aggregate<int32_t>(Aggregate::Max, valueField) == 20);
+    REQUIRE(all.aggregate<double>(Aggregate::Avg, valueField) == 10.5);
+    REQUIRE(all.aggregate<std::string>(Aggregate::Max, stringField) == std::string("item120"));
+    REQUIRE(all.aggregate<int64_t>(Aggregate::Sum, FieldPath{ nestedField, nestedValueField }) == 2100);
+
+    auto filtered = db.query<TestMessage>().where(valueField, Op::Gt, 15);
+    REQUIRE(filtered.aggregate<int64_t>(Aggregate::Sum, valueField) == 90);
+    REQUIRE(filtered.aggregate<double>(Aggregate::Avg, FieldPath{ nestedField, nestedValueField }) == 180.0);
+
+    auto sums = all.aggregateBy<TestMessage::TestEnum, int64_t>(Aggregate::Sum, valueField, enumField);
+    REQUIRE(sums.size() == 3);
+    REQUIRE(sums[TestMessage::val0] == 3 + 6 + 9 + 12 + 15 + 18);
+    REQUIRE(sums[TestMessage::val1] == 1 + 4 + 7 + 10 + 13 + 16 + 19);
+    REQUIRE(sums[TestMessage::val2] == 2 + 5 + 8 + 11 + 14 + 17 + 20);
+
+    auto counts = filtered.aggregateBy<TestMessage::TestEnum, int64_t>(Aggregate::Count, valueField, enumField);
+    REQUIRE(counts == std::map<TestMessage::TestEnum, int64_t>{ { TestMessage::val0, 1 }, { TestMessage::val1, 2 }, { TestMessage::val2, 2 } });
+
+    REQUIRE_THROWS(all.aggregate<double>(Aggregate::Count, valueField));
+    REQUIRE_THROWS(all.aggregate<int64_t>(Aggregate::Avg, valueField));
+    REQUIRE_THROWS(all.aggregate<int64_t>(Aggregate::Sum, stringField));
+    REQUIRE_THROWS(all.aggregate<int64_t>(Aggregate::Sum, nestedField));
+    REQUIRE_THROWS(all.aggregateBy<std::string, int64_t>(Aggregate::Sum, valueField, enumField));
+}
+
+TEST_CASE("Columnar read test", "[smoketest]") {
+    Database db;
+
+    REQUIRE_NOTHROW(db.createTable<TestMessage>());
+    REQUIRE_NOTHROW(db.createTable<StringKeyMessage>());
+
+    const auto* descriptor = TestMessage::GetDescriptor();
+    auto valueField = descriptor->FindFieldByNumber(TestMessage::kValueFieldNumber);
+    auto stringField = descriptor->FindFieldByNumber(TestMessage::kStringValueFieldNumber);
+    auto nestedField = descriptor->FindFieldByNumber(TestMessage::kNestedMessageFieldNumber);
+    auto enumField = descriptor->FindFieldByNumber(TestMessage::kEnumValueFieldNumber);
+
+    std::vector<int32_t> values{ 1, 2, 3 };
+    REQUIRE(db.getColumns<TestMessage>({ valueField }, values) == 0);
+    REQUIRE(values.empty());
+
+    std::vector<TestMessage> messages;
+    for (int i = 0; i < 50; ++i)
+    {
+        TestMessage msg;
+        msg.set_value(i * 3);
+        msg.set_stringvalue(generate_random_string(6));
+        msg.mutable_nestedmessage()->set_value(i);
+        msg.set_enumvalue(static_cast<TestMessage::TestEnum>(i % 4));
+        REQUIRE_NOTHROW(db.insertMessage(msg));
+        messages.emplace_back(std::move(msg));
+    }
+
+    std::vector<double> asDouble;
+    std::vector<std::string> strings;
+    std::vector<TestMessage::TestEnum> enums;
+    REQUIRE(db.getColumns<TestMessage>({ valueField, stringField, enumField, valueField }, values, strings, enums, asDouble) == messages.size());
+    REQUIRE(values.size() == messages.size());
+    REQUIRE(asDouble.size() == messages.size());
+    for (size_t i = 0; i < messages.size(); ++i)
+    {
+        REQUIRE(values[i] == messages[i].value());
+        REQUIRE(asDouble[i] == static_cast<double>(messages[i].value()));
+        REQUIRE(strings[i] == messages[i].stringvalue());
+        REQUIRE(enums[i] == messages[i].enumvalue());
+    }
+
+    std::array<int64_t, 16> chunk{};
+    std::vector<int64_t> chunked;
+    int64_t lastId = std::numeric_limits<int64_t>::min();
+    size_t chunks = 0;
+    while (size_t rows = db.getColumns<TestMessage>({ valueField }, lastId, chunk.size(), chunk.data()))
+    {
+        chunked.insert(chunked.end(), chunk.begin(), chunk.begin() + rows);
+        ++chunks;
+    }
+    REQUIRE(chunks == 4);
+    REQUIRE(chunked.size() == messages.size());
+    for (size_t i = 0; i < messages.size(); ++i)
+        REQUIRE(chunked[i] == messages[i].value());
+
+    for (int i = 0; i < 10; ++i)
+    {
+        StringKeyMessage msg;
+        msg.set_name("key" + std::to_string(i));
+        msg.set_number(std::numeric_limits<uint64_t>::max() - i);
+        msg.set_floatnumber(i * 0.25f);
+        REQUIRE_NOTHROW(db.writeMessage(msg));
+    }
+
+    auto numberField = StringKeyMessage::GetDescriptor()->FindFieldByNumber(StringKeyMessage::kNumberFieldNumber);
+    auto floatField = StringKeyMessage::GetDescriptor()->FindFieldByNumber(StringKeyMessage::kFloatNumberFieldNumber);
+    std::vector<uint64_t> numbers;
+    std::vector<float> floats;
+    REQUIRE(db.getColumns<StringKeyMessage>({ numberField, floatField }, numbers, floats) == 10);
+    for (int i = 0; i < 10; ++i)
+    {
+        REQUIRE(numbers[i] == std::numeric_limits<uint64_t>::max() - i);
+        REQUIRE(floats[i] == i * 0.25f);
+    }
+
+    REQUIRE_NOTHROW(db.createTable<ScalarMessage>());
+    for (int i = 0; i < 5; ++i)
+    {
+        ScalarMessage scalar;
+        scalar.set_id(i);
+        scalar.set_flag(i % 2 == 0);
+        REQUIRE_NOTHROW(db.writeMessage(scalar));
+    }
+    auto flagField = ScalarMessage::GetDescriptor()->FindFieldByNumber(ScalarMessage::kFlagFieldNumber);
+    std::vector<uint8_t> flags;
+    REQUIRE(db.getColumns<ScalarMessage>({ flagField }, flags) == 5);
+    REQUIRE(flags == std::vector<uint8_t>{ 1, 0, 1, 0, 1 });
+
+    std::vector<int32_t> nested;
+    REQUIRE_THROWS(db.getColumns<TestMessage>({ nestedField }, nested));
+    REQUIRE_THROWS(db.getColumns<TestMessage>({ stringField }, values));
+    REQUIRE_THROWS(db.getColumns<TestMessage>({ numberField }, values));
+}
@@ -0,0 +1,316 @@
+#include <google/protobuf/compiler/code_generator.h>
+#include <google/protobuf/compiler/plugin.h>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/descriptor.pb.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream.h>
+
+#include <cctype>
+#include <memory>
+#include <set>
+#include <string>
+
+
+namespace
+{
+
+using CppType = google::protobuf::FieldDescriptor::CppType;
+
+const std::set<std::string> cppKeywords = {
+    "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break", "case", "catch", "char",
+    "class", "compl", "const", "constexpr", "const_cast", "continue", "decltype", "default", "delete", "do", "double",
+    "dynamic_cast", "else", "enum", "explicit", "export", "extern", "false", "float", "for", "friend", "goto", "if",
+    "inline", "int", "long", "mutable", "namespace", "new", "noexcept", "not", "not_eq", "nullptr", "operator", "or",
+    "or_eq", "private", "protected", "public", "register", "reinterpret_cast", "return", "short", "signed", "sizeof",
+    "static", "static_assert", "static_cast", "struct", "switch", "template", "this", "thread_local", "throw", "true",
+    "try", "typedef", "typeid", "typename", "union", "unsigned", "using", "virtual", "void", "volatile", "wchar_t",
+    "while", "xor", "xor_eq"
+};
+
+std::string replaceAll(std::string text, const std::string& from, const std::string& to)
+{
+    for (size_t pos = text.find(from); pos != std::string::npos; pos = text.find(from, pos + to.size()))
+        text.replace(pos, from.size(), to);
+    return text;
+}
+
+std::string getNamespace(const google::protobuf::FileDescriptor* file)
+{
+    if (file->package().empty())
+        return "::";
+    return "::" + replaceAll(file->package(), ".", "::") + "::";
+}
+
+template<typename Descriptor>
+std::string getClassName(const Descriptor* descriptor)
+{
+    std::string name = descriptor->name();
+    for (auto* parent = descriptor->containing_type(); parent; parent = parent->containing_type())
+        name = parent->name() + "_" + name;
+    return getNamespace(descriptor->file()) + name;
+}
+
+std::string getAccessorName(const google::protobuf::FieldDescriptor* field)
+{
+    std::string name = field->name();
+    for (auto& c : name)
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    if (cppKeywords.count(name))
+        name += '_';
+    return name;
+}
+
+std::string getFunctionSuffix(const google::protobuf::FieldDescriptor* field)
+{
+    return replaceAll(field->containing_type()->full_name(), ".", "_") + "_" + std::to_string(field->number());
+}
+
+// expression converting value of the accessor to a type bound by SQLite::Statement
+std::string getBindValue(const google::protobuf::FieldDescriptor* field, const std::string& value)
+{
+    switch (field->cpp_type())
+    {
+    case CppType::CPPTYPE_UINT64:
+        return "static_cast<int64_t>(" + value + ")";
+    case CppType::CPPTYPE_BOOL:
+        return value + " ? 1 : 0";
+    case CppType::CPPTYPE_FLOAT:
+        return "static_cast<double>(" + value + ")";
+    case CppType::CPPTYPE_ENUM:
+        return "static_cast<int>(" + value + ")";
+    default:
+        return value;
+    }
+}
+
+// expression converting value of SQLite::Column to a type of the field
+std::string getColumnValue(const google::protobuf::FieldDescriptor* field)
+{
+    switch (field->cpp_type())
+    {
+    case CppType::CPPTYPE_STRING:
+        return "column.getString()";
+    case CppType::CPPTYPE_INT32:
+        return "column.getInt()";
+    case CppType::CPPTYPE_INT64:
+        return "column.getInt64()";
+    case CppType::CPPTYPE_UINT32:
+        return "static_cast<uint32_t>(column.getInt64())";
+    case CppType::CPPTYPE_UINT64:
+        return "static_cast<uint64_t>(column.getInt64())";
+    case CppType::CPPTYPE_BOOL:
+        return "column.getInt() != 0";
+    case CppType::CPPTYPE_DOUBLE:
+        return "column.getDouble()";
+    case CppType::CPPTYPE_FLOAT:
+        return "static_cast<float>(column.getDouble())";
+    case CppType::CPPTYPE_ENUM:
+        return "static_cast<" + getClassName(field->enum_type()) + ">(column.getInt())";
+    default:
+        return {};
+    }
+}
+
+bool isSupported(const google::protobuf::FieldDescriptor* field)
+{
+    if (field->cpp_type() == CppType::CPPTYPE_MESSAGE)
+        return false;
+
+    // values of closed enums out of range are kept by reflection in unknown fields
+    if (field->cpp_type() == CppType::CPPTYPE_ENUM && field->enum_type()->is_closed())
+        return false;
+
+    return true;
+}
+
+// the functions cast the message only if it's an instance of the generated class, other messages of the type
+// (dynamic messages, for example) are handled by reflection
+void generateField(const google::protobuf::FieldDescriptor* field, std::string& functions, std::string& registrations)
+{
+    const auto className = getClassName(field->containing_type());
+    const auto accessor = getAccessorName(field);
+    const auto suffix = getFunctionSuffix(field);
+    const auto cast = "google::protobuf::DynamicCastToGenerated<" + className + ">(";
+
+    if (field->is_repeated())
+    {
+        functions +=
+            "void bindElement_" + suffix + "(SQLite::Statement& query, int index, const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field, int element)\n"
+            "{\n"
+            "    const auto* typed = " + cast + "&message);\n"
+            "    if (!typed)\n"
+            "        return ProtoDatabase::TablePlan::getReflectionBindElementFunction(field)(query, index, message, field, element);\n"
+            "    query.bind(index, " + getBindValue(field, "typed->" + accessor + "(element)") + ");\n"
+            "}\n"
+            "\n"
+            "void addElement_" + suffix + "(const SQLite::Column& column, google::protobuf::Message* message, const google::protobuf::FieldDescriptor* field)\n"
+            "{\n"
+            "    auto* typed = " + cast + "message);\n"
+            "    if (!typed)\n"
+            "        return ProtoDatabase::TablePlan::getReflectionAddFunction(field)(column, message, field);\n"
+            "    typed->add_" + accessor + "(" + getColumnValue(field) + ");\n"
+            "}\n"
+            "\n";
+
+        registrations +=
+            "    ProtoDatabase::TablePlan::registerAccessors(" + className + "::descriptor(), " + std::to_string(field->number()) + ", "
+            "{ nullptr, nullptr, &bindElement_" + suffix + ", &addElement_" + suffix + " });\n";
+        return;
+    }
+
+    functions +=
+        "void bind_" + suffix + "(SQLite::Statement& query, int index, const google::protobuf::Message& message, const google::protobuf::FieldDescriptor* field)\n"
+        "{\n"
+        "    const auto* typed = " + cast + "&message);\n"
+        "    if (!typed)\n"
+        "        return ProtoDatabase::TablePlan::getReflectionBindFunction(field)(query, index, message, field);\n"
+        "    query.bind(index, " + getBindValue(field, "typed->" + accessor + "()") + ");\n"
+        "}\n"
+        "\n"
+        "void read_" + suffix + "(const SQLite::Column& column, google::protobuf::Message* message, const google::protobuf::FieldDescriptor* field)\n"
+        "{\n"
+        "    auto* typed = " + cast + "message);\n"
+        "    if (!typed)\n"
+        "        return ProtoDatabase::TablePlan::getReflectionReadFunction(field)(column, message, field);\n"
+        "    typed->set_" + accessor + "(" + getColumnValue(field) + ");\n"
+        "}\n"
+        "\n";
+
+    registrations +=
+        "    ProtoDatabase::TablePlan::registerAccessors(" + className + "::descriptor(), " + std::to_string(field->number()) + ", "
+        "{ &bind_" + suffix + ", &read_" + suffix + ", nullptr, nullptr });\n";
+}
+
+void generateMessage(const google::protobuf::Descriptor* descriptor, std::string& functions, std::string& registrations)
+{
+    // entries of maps are stored through reflection of the owner
+    if (descriptor->options().map_entry())
+        return;
+
+    for (int i = 0; i < descriptor->field_count(); ++i)
+    {
+        const auto* field = descriptor->field(i);
+        if (isSupported(field))
+            generateField(field, functions, registrations);
+    }
+
+    for (int i = 0; i < descriptor->nested_type_count(); ++i)
+        generateMessage(descriptor->nested_type(i), functions, registrations);
+}
+
+// name of the registration function: register<File>Accessors for <dir>/<file>.proto
+std::string getRegisterFunctionName(const std::string& baseName)
+{
+    std::string name;
+    bool upper = true;
+    for (char c : baseName.substr(baseName.rfind('/') + 1))
+    {
+        if (!std::isalnum(static_cast<unsigned char>(c)))
+        {
+            upper = true;
+            continue;
+        }
+        name += upper ? static_cast<char>(std::toupper(static_cast<unsigned char>(c))) : c;
+        upper = false;
+    }
+    return "register" + name + "Accessors";
+}
+
+bool writeFile(google::protobuf::compiler::GeneratorContext* context, const std::string& name, const std::string& content, std::string* error)
+{
+    std::unique_ptr<google::protobuf::io::ZeroCopyOutputStream> output(context->Open(name));
+    if (!output)
+    {
+        *error = "couldn't open " + name;
+        return false;
+    }
+
+    google::protobuf::io::CodedOutputStream stream(output.get());
+    stream.WriteString(content);
+    if (stream.HadError())
+    {
+        *error = "couldn't write " + name;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief The AccessorGenerator class
+ *
+ * Emits <name>.pdb.h and <name>.pdb.cc next to <name>.pb.cc with bind and read functions of every scalar field
+ * using generated accessors. They are registered in TablePlan by register<Name>Accessors(), which has to be called
+ * before tables of these messages are used
+ */
+class AccessorGenerator : public google::protobuf::compiler::CodeGenerator
+{
+public:
+    bool Generate(const google::protobuf::FileDescriptor* file, const std::string& parameter, google::protobuf::compiler::GeneratorContext* context, std::string* error) const override
+    {
+        if (!parameter.empty())
+        {
+            *error = "protoc-gen-protodb takes no parameters, got: " + parameter;
+            return false;
+        }
+
+        std::string functions;
+        std::string registrations;
+        for (int i = 0; i < file->message_type_count(); ++i)
+            generateMessage(file->message_type(i), functions, registrations);
+
+        const auto baseName = file->name().substr(0, file->name().rfind(".proto"));
+        const auto functionName = getRegisterFunctionName(baseName);
+        const auto ns = getNamespace(file);
+        const auto openNamespace = ns == "::" ? std::string() : "namespace " + ns.substr(2, ns.size() - 4) + "\n{\n\n";
+        const auto closeNamespace = ns == "::" ? std::string() : "\n}\n";
+
+        const std::string header =
+            "// Generated by protoc-gen-protodb. DO NOT EDIT!\n"
+            "// source: " + file->name() + "\n"
+            "\n"
+            "#pragma once\n"
+            "\n" +
+            openNamespace +
+            "// registers bind and read functions of messages of the file in ProtoDatabase::TablePlan\n"
+            "void " + functionName + "();\n" +
+            closeNamespace;
+
+        const std::string source =
+            "// Generated by protoc-gen-protodb. DO NOT EDIT!\n"
+            "// source: " + file->name() + "\n"
+            "\n"
+            "#include \"" + baseName + ".pdb.h\"\n"
+            "#include \"" + baseName + ".pb.h\"\n"
+            "\n"
+            "#include <ProtoDatabase/TablePlan.h>\n"
+            "\n"
+            "\n"
+            "namespace\n"
+            "{\n"
+            "\n" +
+            functions +
+            "}\n"
+            "\n" +
+            openNamespace +
+            "void " + functionName + "()\n"
+            "{\n" +
+            registrations +
+            "}\n" +
+            closeNamespace;
+
+        return writeFile(context, baseName + ".pdb.h", header, error) && writeFile(context, baseName + ".pdb.cc", source, error);
+    }
+
+    uint64_t GetSupportedFeatures() const override
+    {
+        return FEATURE_PROTO3_OPTIONAL;
+    }
+};
+
+}
+
+int main(int argc, char* argv[])
+{
+    AccessorGenerator generator;
+    return google::protobuf::compiler::PluginMain(argc, argv, &generator);
+}